@@ -0,0 +1,577 @@
+/*
+ * Copyright (C) 2016 Frederic Meyer
+ *
+ * This file is part of NoDS.
+ *
+ * NoDS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * NoDS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NoDS. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "arm_cache.h"
+#include "arm_macro.h"
+#include "arm_profile.h"
+
+void arm4_execute(arm_cpu* cpu, u32 instruction, arm_instruction type);
+void arm4_execute_thumb(arm_cpu* cpu, u16 instruction, thumb_instruction type);
+void arm4_execute_thumb_alu(arm_cpu* cpu, u16 instruction, thumb_instruction type);
+void arm4_execute_thumb_fused(arm_cpu* cpu, arm_op* op);
+
+// Condition flags as used by the liveness pass
+#define FLAG_N 8
+#define FLAG_Z 4
+#define FLAG_C 2
+#define FLAG_V 1
+#define FLAG_ALL 15
+
+arm_cache* arm_cache_make()
+{
+    return calloc(1, sizeof(arm_cache));
+}
+
+void arm_cache_free(arm_cache* cache)
+{
+    free(cache->saved);
+    free(cache);
+}
+
+void arm_cache_flush(arm_cache* cache)
+{
+    for (int i = 0; i < ARM_CACHE_BLOCKS; i++) {
+        cache->blocks[i].valid = false;
+    }
+    cache->current = NULL;
+    cache->stale = false;
+}
+
+void arm_cache_invalidate(arm_cache* cache, u8* code, u32 size)
+{
+    for (int i = 0; i < ARM_CACHE_BLOCKS; i++) {
+        arm_block* block = &cache->blocks[i];
+        u32 length = block->length * (block->thumb ? SIZE_HWORD : SIZE_WORD);
+
+        if (block->valid && block->code != NULL && block->code < code + size && code < block->code + length) {
+            LOG(LOG_CPU, LOG_INFO, "CACHE: code at 0x%x overwritten", block->address);
+            block->valid = false;
+
+            // Re-decode if this happened in the middle of the current block
+            if (block == cache->current) {
+                cache->current = NULL;
+            }
+        }
+    }
+}
+
+static bool arm_ends_block(u32 instruction, arm_instruction type)
+{
+    bool load = instruction & (1 << 20);
+    int reg_dest = (instruction >> 12) & 0xF;
+
+    switch (type) {
+    case ARM_3:
+    case ARM_10:
+    case ARM_12:
+    case ARM_16:
+    case ARM_ERROR:
+        return true;
+    case ARM_5:
+    case ARM_6:
+    case ARM_7:
+    case ARM_9:
+        return load && reg_dest == 15;
+    case ARM_8:
+        // Writes to r15 or the program status registers
+        return reg_dest == 15 || (instruction & 0xDB0F000) == 0x120F000;
+    case ARM_11:
+        // Loads r15 or transfers the user bank
+        return (load && (instruction & (1 << 15))) || (instruction & (1 << 22));
+    default:
+        return false;
+    }
+}
+
+static bool thumb_ends_block(u16 instruction, thumb_instruction type)
+{
+    switch (type) {
+    case THUMB_5: {
+        int opcode = (instruction >> 8) & 3;
+        int reg_dest = (instruction & 7) | ((instruction >> 4) & 8);
+        return opcode == 0b11 || (opcode != 0b01 && reg_dest == 15);
+    }
+    case THUMB_14:
+        return (instruction & (1 << 11)) && (instruction & (1 << 8));
+    case THUMB_16:
+    case THUMB_17:
+    case THUMB_18:
+    case THUMB_ERROR:
+        return true;
+    case THUMB_19:
+        return instruction & (1 << 11);
+    default:
+        return false;
+    }
+}
+
+// Determines which flags a THUMB instruction reads, which it always overwrites
+// (def) and which it may overwrite depending on operands (may_def).
+static void thumb_flag_usage(u16 instruction, thumb_instruction type, int* use, int* def, int* may_def)
+{
+    *use = 0;
+    *def = 0;
+
+    switch (type) {
+    case THUMB_1:
+        // LSL #0 leaves the carry untouched
+        *def = FLAG_N | FLAG_Z;
+        if ((instruction & 0x1800) != 0 || (instruction & 0x07C0) != 0) {
+            *def |= FLAG_C;
+        }
+        break;
+    case THUMB_2:
+        *def = FLAG_ALL;
+        break;
+    case THUMB_3:
+        *def = ((instruction >> 11) & 3) == 0b00 ? (FLAG_N | FLAG_Z) : FLAG_ALL;
+        break;
+    case THUMB_4:
+        switch ((instruction >> 6) & 0xF) {
+        case 0b0010:
+        case 0b0011:
+        case 0b0100:
+        case 0b0111:
+            // Shifts by zero leave the carry untouched
+            *def = FLAG_N | FLAG_Z;
+            *may_def = FLAG_N | FLAG_Z | FLAG_C;
+            return;
+        case 0b0101:
+        case 0b0110:
+            *use = FLAG_C;
+            *def = FLAG_ALL;
+            break;
+        case 0b1001:
+        case 0b1010:
+        case 0b1011:
+            *def = FLAG_ALL;
+            break;
+        case 0b1101:
+            *def = FLAG_N | FLAG_Z | FLAG_C;
+            break;
+        default:
+            *def = FLAG_N | FLAG_Z;
+            break;
+        }
+        break;
+    case THUMB_5:
+        if (((instruction >> 8) & 3) == 0b01) {
+            *def = FLAG_ALL;
+        }
+        break;
+    case THUMB_8:
+        // STRH, the other opcodes are loads
+        if ((instruction & 0x0C00) == 0) {
+            *use = FLAG_ALL;
+        }
+        break;
+    case THUMB_7:
+    case THUMB_9:
+    case THUMB_10:
+    case THUMB_11:
+    case THUMB_14:
+    case THUMB_15:
+        // A store may overwrite the rest of the block, which invalidates it.
+        // The flags must be valid then since the new code may read them.
+        if (!(instruction & (1 << 11))) {
+            *use = FLAG_ALL;
+        }
+        break;
+    case THUMB_16:
+        *use = FLAG_ALL;
+        break;
+    default:
+        break;
+    }
+
+    *may_def = *def;
+}
+
+// Backward liveness pass over a THUMB block. THUMB.1-THUMB.4 instructions whose
+// flags are all overwritten before being read skip the flag update. Everything
+// is assumed live at the block exit, so the flags are valid again by then.
+static void thumb_flag_liveness(arm_block* block)
+{
+    int live = FLAG_ALL;
+    int stale = 0;
+
+    for (int i = block->length - 1; i >= 0; i--) {
+        arm_op* op = &block->ops[i];
+        int use, def, may_def;
+
+        thumb_flag_usage(op->opcode, op->type, &use, &def, &may_def);
+
+        if (op->type >= THUMB_1 && op->type <= THUMB_4 && (may_def & live) == 0) {
+            op->flags |= OP_SKIP_FLAGS;
+        }
+
+        live = (live & ~def) | use;
+    }
+
+    // Mark the instructions after which the CPSR doesn't hold the real flags
+    for (int i = 0; i < block->length; i++) {
+        arm_op* op = &block->ops[i];
+        int use, def, may_def;
+
+        thumb_flag_usage(op->opcode, op->type, &use, &def, &may_def);
+
+        if (op->flags & OP_SKIP_FLAGS) {
+            stale |= may_def;
+        } else {
+            stale &= ~def;
+        }
+
+        if (stale != 0) {
+            op->flags |= OP_STALE_FLAGS;
+        }
+    }
+}
+
+// Derives type, fusion and flag liveness of every op from the opcodes
+static void arm_block_analyze(arm_block* block)
+{
+    for (int i = 0; i < block->length; i++) {
+        arm_op* op = &block->ops[i];
+
+        op->fusion = FUSE_NONE;
+        op->flags = 0;
+
+        if (block->thumb) {
+            op->type = arm_decode_thumb(op->opcode);
+
+            // Fuse with the previous instruction unless that
+            // one already is the second half of another pair.
+            if (i >= 1 && (i < 2 || op[-2].fusion == FUSE_NONE)) {
+                op[-1].fusion = arm_fuse_thumb(op[-1].opcode, op->opcode);
+            }
+        } else {
+            op->type = arm_decode(op->opcode);
+        }
+    }
+
+    if (block->thumb) {
+        thumb_flag_liveness(block);
+    }
+}
+
+static void arm_cache_decode(arm_cpu* cpu, arm_block* block, u32 address, bool thumb)
+{
+    int size = thumb ? SIZE_HWORD : SIZE_WORD;
+    bool end = false;
+
+    block->address = address;
+    block->thumb = thumb;
+    block->valid = true;
+    block->length = 0;
+
+    while (!end && block->length < ARM_BLOCK_LENGTH) {
+        arm_op* op = &block->ops[block->length];
+
+        if (thumb) {
+            op->opcode = MEM_FETCH_16(address);
+            end = thumb_ends_block(op->opcode, arm_decode_thumb(op->opcode));
+        } else {
+            op->opcode = MEM_FETCH_32(address);
+            end = arm_ends_block(op->opcode, arm_decode(op->opcode));
+        }
+
+        block->length++;
+        address += size;
+    }
+
+    arm_block_analyze(block);
+
+    LOG(LOG_CPU, LOG_INFO, "CACHE: decoded block at 0x%x (%d instructions)", block->address, block->length);
+}
+
+static int arm_block_compare(const void* a, const void* b)
+{
+    const arm_block* block_a = a;
+    const arm_block* block_b = b;
+
+    if (block_a->address != block_b->address) {
+        return block_a->address < block_b->address ? -1 : 1;
+    }
+    return block_a->thumb - block_b->thumb;
+}
+
+// Takes the block from the cache file, if there is one at address
+// and memory still holds the same instructions.
+static bool arm_cache_restore(arm_cpu* cpu, arm_block* block, u32 address, bool thumb)
+{
+    arm_cache* cache = cpu->cache;
+    arm_block key = { .address = address, .thumb = thumb };
+    arm_block* saved;
+
+    if (cache->saved == NULL) {
+        return false;
+    }
+
+    saved = bsearch(&key, cache->saved, cache->saved_count, sizeof(arm_block), arm_block_compare);
+    if (saved == NULL) {
+        return false;
+    }
+
+    for (int i = 0; i < saved->length; i++) {
+        u32 opcode = thumb ? MEM_FETCH_16(address + i * SIZE_HWORD) : MEM_FETCH_32(address + i * SIZE_WORD);
+
+        if (saved->ops[i].opcode != opcode) {
+            return false;
+        }
+    }
+
+    *block = *saved;
+    block->valid = true;
+    return true;
+}
+
+static arm_block* arm_cache_lookup(arm_cpu* cpu, u32 address, bool thumb)
+{
+    arm_block* block = &cpu->cache->blocks[(address >> 1) & (ARM_CACHE_BLOCKS - 1)];
+    int size = thumb ? SIZE_HWORD : SIZE_WORD;
+
+    if (!block->valid || block->address != address || block->thumb != thumb) {
+        if (!arm_cache_restore(cpu, block, address, thumb)) {
+            arm_cache_decode(cpu, block, address, thumb);
+        }
+
+        // Have writes to the code reported so that the block gets invalidated
+        block->code = MEM_MAP(address, block->length * size, false);
+        if (block->code != NULL) {
+            MEM_WATCH(block->code, block->length * size);
+        }
+    }
+
+    return block;
+}
+
+void arm_step_cached(arm_cpu* cpu)
+{
+    arm_state* state = cpu->state;
+    arm_cache* cache = cpu->cache;
+    arm_block* block = cache->current;
+    bool thumb = state->cpsr & CPSR_THUMB;
+    int size = thumb ? SIZE_HWORD : SIZE_WORD;
+    u32 address;
+    arm_op* op;
+
+    state->r15 &= thumb ? ~1 : ~3;
+
+    // Opcodes come from the decoded block, so filling the
+    // pipeline only has to keep r15 two instructions ahead.
+    if (cpu->pipeline.status < 2) {
+        cpu->pipeline.status++;
+        state->r15 += size;
+        return;
+    }
+
+    address = state->r15 - 2 * size;
+
+    // Continue in the current block if the instruction follows
+    // the previous one, otherwise look up the block at address.
+    if (block == NULL || cache->index >= block->length || block->thumb != thumb ||
+        block->address + cache->index * size != address) {
+        block = cache->current = arm_cache_lookup(cpu, address, thumb);
+        cache->index = 0;
+    }
+
+    op = &block->ops[cache->index];
+
+    TRACE_EXECUTE(address, op->opcode);
+    if (op->fusion != FUSE_NONE) {
+        TRACE_EXECUTE(address + SIZE_HWORD, op[1].opcode);
+    }
+
+    if (op->fusion != FUSE_NONE) {
+        // The cycles of both instructions are attributed to the first one
+        PROFILE_EXECUTE(arm4_execute_thumb_fused(cpu, op), address, op[0].opcode, true, op[0].type);
+#ifdef ARM_PROFILE
+        arm_profile_record(cpu, address + SIZE_HWORD, op[1].opcode, true, op[1].type, 0);
+#endif
+        cache->stale = op[1].flags & OP_STALE_FLAGS;
+        cache->index += 2;
+    } else if (thumb) {
+        if (op->flags & OP_SKIP_FLAGS) {
+            PROFILE_EXECUTE(arm4_execute_thumb_alu(cpu, op->opcode, op->type), address, op->opcode, true, op->type);
+        } else {
+            PROFILE_EXECUTE(arm4_execute_thumb(cpu, op->opcode, op->type), address, op->opcode, true, op->type);
+        }
+        cache->stale = op->flags & OP_STALE_FLAGS;
+        cache->index++;
+    } else {
+        PROFILE_EXECUTE(arm4_execute(cpu, op->opcode, op->type), address, op->opcode, false, op->type);
+        cache->index++;
+    }
+
+    if (cpu->pipeline.flush) {
+        FLUSH;
+        cache->current = NULL;
+        return;
+    }
+
+    state->r15 += size;
+}
+
+typedef struct {
+    char magic[4];
+    u32 version;
+    u64 key;
+    u32 count;
+} arm_cache_file;
+
+static bool arm_cache_read_opcodes(arm_block* block, int length, FILE* file)
+{
+    for (int i = 0; i < length; i++) {
+        if (fread(&block->ops[i].opcode, sizeof(u32), 1, file) != 1) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool arm_cache_load(arm_cache* cache, char* path, u64 key)
+{
+    FILE* file = fopen(path, "rb");
+    arm_cache_file header;
+    arm_block* saved = NULL;
+    long start;
+    long end;
+
+    if (file == NULL) {
+        return false;
+    }
+
+    // The cache belongs to another ROM or emulator version
+    if (fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, "NDSC", 4) != 0 ||
+        header.version != ARM_CACHE_VERSION || header.key != key) {
+        LOG(LOG_CPU, LOG_WARN, "CACHE: %s is outdated, ignoring it", path);
+        fclose(file);
+        return false;
+    }
+
+    // Each block takes at least one opcode, a corrupt count must not
+    // allocate more blocks than the rest of the file can hold
+    start = ftell(file);
+    end = fseek(file, 0, SEEK_END) == 0 ? ftell(file) : -1;
+    if (start >= 0 && end >= start && fseek(file, start, SEEK_SET) == 0 &&
+        header.count <= (u64)(end - start) / (sizeof(u32) + 2 + sizeof(u32))) {
+        saved = calloc(header.count, sizeof(arm_block));
+    }
+    if (saved == NULL && header.count != 0) {
+        LOG(LOG_CPU, LOG_ERROR, "CACHE: %s is truncated", path);
+        fclose(file);
+        return false;
+    }
+
+    for (u32 i = 0; i < header.count; i++) {
+        arm_block* block = &saved[i];
+        u8 thumb, length;
+
+        if (fread(&block->address, sizeof(u32), 1, file) != 1 || fread(&thumb, 1, 1, file) != 1 ||
+            fread(&length, 1, 1, file) != 1 || length == 0 || length > ARM_BLOCK_LENGTH ||
+            !arm_cache_read_opcodes(block, length, file)) {
+            LOG(LOG_CPU, LOG_ERROR, "CACHE: %s is truncated", path);
+            free(saved);
+            fclose(file);
+            return false;
+        }
+
+        // Only the opcodes are taken from the file, they are compared
+        // with memory on restore. Everything else is derived again.
+        block->thumb = thumb;
+        block->length = length;
+        arm_block_analyze(block);
+
+        // Decoding ends a block at the first such instruction
+        for (int j = 0; j < length - 1; j++) {
+            arm_op* op = &block->ops[j];
+
+            if (thumb ? thumb_ends_block(op->opcode, op->type) : arm_ends_block(op->opcode, op->type)) {
+                LOG(LOG_CPU, LOG_ERROR, "CACHE: %s holds an invalid block at 0x%x", path, block->address);
+                free(saved);
+                fclose(file);
+                return false;
+            }
+        }
+    }
+
+    fclose(file);
+    qsort(saved, header.count, sizeof(arm_block), arm_block_compare);
+
+    free(cache->saved);
+    cache->saved = saved;
+    cache->saved_count = header.count;
+
+    LOG(LOG_CPU, LOG_INFO, "CACHE: loaded %u blocks from %s", header.count, path);
+    return true;
+}
+
+static void arm_cache_write_block(arm_block* block, FILE* file)
+{
+    u8 thumb = block->thumb;
+    u8 length = block->length;
+
+    fwrite(&block->address, sizeof(u32), 1, file);
+    fwrite(&thumb, 1, 1, file);
+    fwrite(&length, 1, 1, file);
+    for (int i = 0; i < length; i++) {
+        fwrite(&block->ops[i].opcode, sizeof(u32), 1, file);
+    }
+}
+
+bool arm_cache_save(arm_cache* cache, char* path, u64 key)
+{
+    FILE* file = fopen(path, "wb");
+    arm_cache_file header = { .magic = "NDSC", .version = ARM_CACHE_VERSION, .key = key, .count = 0 };
+
+    if (file == NULL) {
+        LOG(LOG_CPU, LOG_ERROR, "CACHE: cannot write %s", path);
+        return false;
+    }
+
+    // Count is written again once known
+    fwrite(&header, sizeof(header), 1, file);
+
+    for (int i = 0; i < ARM_CACHE_BLOCKS; i++) {
+        if (cache->blocks[i].valid) {
+            arm_cache_write_block(&cache->blocks[i], file);
+            header.count++;
+        }
+    }
+
+    // Keep saved blocks which weren't used this time, unless replaced
+    for (int i = 0; i < cache->saved_count; i++) {
+        arm_block* saved = &cache->saved[i];
+        arm_block* block = &cache->blocks[(saved->address >> 1) & (ARM_CACHE_BLOCKS - 1)];
+
+        if (!block->valid || block->address != saved->address || block->thumb != saved->thumb) {
+            arm_cache_write_block(saved, file);
+            header.count++;
+        }
+    }
+
+    fseek(file, 0, SEEK_SET);
+    fwrite(&header, sizeof(header), 1, file);
+    fclose(file);
+
+    LOG(LOG_CPU, LOG_INFO, "CACHE: saved %u blocks to %s", header.count, path);
+    return true;
+}
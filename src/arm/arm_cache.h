@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2016 Frederic Meyer
+ *
+ * This file is part of NoDS.
+ *
+ * NoDS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * NoDS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NoDS. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _ARM_CACHE_H_
+#define _ARM_CACHE_H_
+
+#include "arm_global.h"
+#include "arm_cpu.h"
+#include "arm_decode.h"
+
+#define ARM_BLOCK_LENGTH 32
+#define ARM_CACHE_BLOCKS 2048
+
+// Must be increased whenever the file format changes
+#define ARM_CACHE_VERSION 2
+
+// A straight run of decoded instructions, which ends at
+// the first instruction that may change the control flow.
+typedef struct {
+    u32 address;
+    u8* code; // host memory of the instructions, NULL if not directly mapped
+    bool thumb;
+    bool valid;
+    int length;
+    arm_op ops[ARM_BLOCK_LENGTH];
+} arm_block;
+
+// Blocks are invalidated when the memory reports writes to their code.
+// TODO: Blocks outside of directly mapped RAM are not tracked.
+typedef struct arm_cache {
+    arm_block* current;
+    int index;
+    bool stale; // the CPSR flags are not up to date
+
+    // Blocks loaded from a cache file, sorted by address. They are
+    // validated against memory the first time they are looked up.
+    arm_block* saved;
+    int saved_count;
+
+    arm_block blocks[ARM_CACHE_BLOCKS];
+} arm_cache;
+
+arm_cache* arm_cache_make();
+void arm_cache_free(arm_cache* cache);
+void arm_cache_flush(arm_cache* cache);
+void arm_cache_invalidate(arm_cache* cache, u8* code, u32 size);
+bool arm_cache_load(arm_cache* cache, char* path, u64 key);
+bool arm_cache_save(arm_cache* cache, char* path, u64 key);
+void arm_step_cached(arm_cpu* cpu);
+
+#endif
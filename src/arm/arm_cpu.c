@@ -18,11 +18,16 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
 #include "arm_cpu.h"
+#include "arm_cache.h"
 #include "arm_macro.h"
+#include "arm_decode.h"
+#include "arm_profile.h"
+#include "arm_trace.h"
 
-void arm4_execute(arm_cpu* cpu, u32 instruction);
-void arm4_execute_thumb(arm_cpu* cpu, u16 instruction);
+void arm4_execute(arm_cpu* cpu, u32 instruction, arm_instruction type);
+void arm4_execute_thumb(arm_cpu* cpu, u16 instruction, thumb_instruction type);
 
 arm_state* arm_make_state()
 {
@@ -46,61 +51,121 @@ arm_cpu* arm_make(arm_version version)
     arm_cpu* cpu = calloc(1, sizeof(arm_cpu));
     cpu->state = arm_make_state();
     cpu->version = version;
+#ifdef ARM_PROFILE
+    cpu->profile = arm_profile_make();
+#endif
+#ifdef ARM_TRACE
+    cpu->trace = arm_trace_make();
+#endif
     return cpu;
 }
 
 void arm_free(arm_cpu* cpu)
 {
+    if (cpu->cache != NULL) {
+        arm_cache_free(cpu->cache);
+    }
+    if (cpu->profile != NULL) {
+        arm_profile_free(cpu->profile);
+    }
+    if (cpu->trace != NULL) {
+        arm_trace_free(cpu->trace);
+    }
     free(cpu->state);
     free(cpu);
 }
 
+void arm_use_cache(arm_cpu* cpu, bool enable)
+{
+    arm_state* state = cpu->state;
+    int status = cpu->pipeline.status;
+    int size = (state->cpsr & CPSR_THUMB) ? SIZE_HWORD : SIZE_WORD;
+
+    if (enable == (cpu->cache != NULL)) {
+        return;
+    }
+
+    if (enable) {
+        cpu->cache = arm_cache_make();
+    } else {
+        arm_cache_free(cpu->cache);
+        cpu->cache = NULL;
+    }
+
+    // Only the plain interpreter keeps prefetched opcodes in the pipeline,
+    // so restart the pipeline at the next instruction to be executed.
+    state->r15 -= (status < 2 ? status : 2) * size;
+    FLUSH;
+}
+
+static inline void arm_execute(arm_cpu* cpu, u32 instruction)
+{
+    arm_instruction type = arm_decode(instruction);
+
+    TRACE_EXECUTE(cpu->state->r15 - 8, instruction);
+    PROFILE_EXECUTE(arm4_execute(cpu, instruction, type), cpu->state->r15 - 8, instruction, false, type);
+}
+
+static inline void arm_execute_thumb(arm_cpu* cpu, u16 instruction)
+{
+    thumb_instruction type = arm_decode_thumb(instruction);
+
+    TRACE_EXECUTE(cpu->state->r15 - 4, instruction);
+    PROFILE_EXECUTE(arm4_execute_thumb(cpu, instruction, type), cpu->state->r15 - 4, instruction, true, type);
+}
+
 void arm_step(arm_cpu* cpu)
 {
     arm_state* state = cpu->state;
     bool thumb = state->cpsr & CPSR_THUMB;
+
+    if (cpu->cache != NULL) {
+        arm_step_cached(cpu);
+        return;
+    }
+
     if (thumb) {
         state->r15 &= ~1;
         switch (cpu->pipeline.status) {
         case 0:
-            cpu->pipeline.opcode[0] = MEM_READ_16(state->r15);
+            cpu->pipeline.opcode[0] = MEM_FETCH_16(state->r15);
             break;
         case 1:
-            cpu->pipeline.opcode[1] = MEM_READ_16(state->r15);
+            cpu->pipeline.opcode[1] = MEM_FETCH_16(state->r15);
             break;
         case 2:
-            cpu->pipeline.opcode[2] = MEM_READ_16(state->r15); 
-            arm4_execute_thumb(cpu, cpu->pipeline.opcode[0]);
+            cpu->pipeline.opcode[2] = MEM_FETCH_16(state->r15); 
+            arm_execute_thumb(cpu, cpu->pipeline.opcode[0]);
             break;
         case 3:
-            cpu->pipeline.opcode[0] = MEM_READ_16(state->r15);
-            arm4_execute_thumb(cpu, cpu->pipeline.opcode[1]);
+            cpu->pipeline.opcode[0] = MEM_FETCH_16(state->r15);
+            arm_execute_thumb(cpu, cpu->pipeline.opcode[1]);
             break;
         case 4:
-            cpu->pipeline.opcode[1] = MEM_READ_16(state->r15);
-            arm4_execute_thumb(cpu, cpu->pipeline.opcode[2]);
+            cpu->pipeline.opcode[1] = MEM_FETCH_16(state->r15);
+            arm_execute_thumb(cpu, cpu->pipeline.opcode[2]);
             break;
         }
     } else {
         state->r15 &= ~3;
         switch (cpu->pipeline.status) {
         case 0:
-            cpu->pipeline.opcode[0] = MEM_READ_32(state->r15);
+            cpu->pipeline.opcode[0] = MEM_FETCH_32(state->r15);
             break;
         case 1:
-            cpu->pipeline.opcode[1] = MEM_READ_32(state->r15);
+            cpu->pipeline.opcode[1] = MEM_FETCH_32(state->r15);
             break;
         case 2:
-            cpu->pipeline.opcode[2] = MEM_READ_32(state->r15); 
-            arm4_execute(cpu, cpu->pipeline.opcode[0]);
+            cpu->pipeline.opcode[2] = MEM_FETCH_32(state->r15); 
+            arm_execute(cpu, cpu->pipeline.opcode[0]);
             break;
         case 3:
-            cpu->pipeline.opcode[0] = MEM_READ_32(state->r15);
-            arm4_execute(cpu, cpu->pipeline.opcode[1]);
+            cpu->pipeline.opcode[0] = MEM_FETCH_32(state->r15);
+            arm_execute(cpu, cpu->pipeline.opcode[1]);
             break;
         case 4:
-            cpu->pipeline.opcode[1] = MEM_READ_32(state->r15);
-            arm4_execute(cpu, cpu->pipeline.opcode[2]);
+            cpu->pipeline.opcode[1] = MEM_FETCH_32(state->r15);
+            arm_execute(cpu, cpu->pipeline.opcode[2]);
             break;
         }
     }
@@ -117,8 +182,19 @@ void arm_step(arm_cpu* cpu)
 void arm_trigger_irq(arm_cpu* cpu)
 {
     arm_state* state = cpu->state;
+
+    // The cached interpreter may be in the middle of skipped flag updates,
+    // the IRQ is taken once the flags are valid again.
+    if (cpu->cache != NULL && cpu->cache->stale) {
+        return;
+    }
+
     if (!(state->cpsr & CPSR_IRQ_DISABLE)) {
-        state->r_irq[1] = state->r15 - ((state->cpsr & CPSR_THUMB) ? 4 : 8) + SIZE_WORD;
+        int size = (state->cpsr & CPSR_THUMB) ? SIZE_HWORD : SIZE_WORD;
+        int ahead = cpu->pipeline.status < 2 ? cpu->pipeline.status : 2;
+
+        // r15 is less than two instructions ahead while the pipeline refills
+        state->r_irq[1] = state->r15 - ahead * size + SIZE_WORD;
         state->r15 = cpu->base_vector + EXCPT_IRQ;
         state->spsr_irq = state->cpsr;
         state->cpsr = (state->cpsr & ~(CPSR_MODE | CPSR_THUMB)) | MODE_IRQ | CPSR_IRQ_DISABLE;
@@ -127,3 +203,98 @@ void arm_trigger_irq(arm_cpu* cpu)
     }
 }
 
+// Registers, pipeline and cycle counter. Host pointers are not
+// written, they are derived from the mode again on load. Only the
+// number of prefetched instructions is kept, with r15 rewound to the
+// next one as arm_use_cache does, so either interpreter can resume it.
+bool arm_save_state(arm_cpu* cpu, FILE* file)
+{
+    arm_state state = *cpu->state;
+    int size = (state.cpsr & CPSR_THUMB) ? SIZE_HWORD : SIZE_WORD;
+    int ahead = cpu->pipeline.status < 2 ? cpu->pipeline.status : 2;
+
+    state.r15 -= ahead * size;
+
+    return fwrite(&state, sizeof(arm_state), 1, file) == 1 &&
+           fwrite(&ahead, sizeof(int), 1, file) == 1 &&
+           fwrite(&cpu->base_vector, sizeof(u32), 1, file) == 1 &&
+           fwrite(&cpu->cycles, sizeof(int), 1, file) == 1;
+}
+
+// Reads a state written by arm_save_state without applying it
+bool arm_read_state(arm_saved_state* saved, FILE* file)
+{
+    if (fread(&saved->state, sizeof(arm_state), 1, file) != 1 ||
+        fread(&saved->ahead, sizeof(int), 1, file) != 1 ||
+        fread(&saved->base_vector, sizeof(u32), 1, file) != 1 ||
+        fread(&saved->cycles, sizeof(int), 1, file) != 1) {
+        return false;
+    }
+
+    switch (saved->state.cpsr & CPSR_MODE) {
+    case MODE_USR:
+    case MODE_FIQ:
+    case MODE_IRQ:
+    case MODE_SVC:
+    case MODE_ABT:
+    case MODE_UND:
+    case MODE_SYS:
+        return saved->ahead >= 0 && saved->ahead <= 2;
+    default:
+        return false;
+    }
+}
+
+// Memory must already hold the code the state continues with
+void arm_restore_state(arm_cpu* cpu, const arm_saved_state* saved_state)
+{
+    arm_state* state = cpu->state;
+    const arm_state* saved = &saved_state->state;
+    int ahead = saved_state->ahead;
+
+    cpu->base_vector = saved_state->base_vector;
+    cpu->cycles = saved_state->cycles;
+
+    memcpy(state->r, saved->r, sizeof(saved->r));
+    memcpy(state->r_fiq, saved->r_fiq, sizeof(saved->r_fiq));
+    memcpy(state->r_svc, saved->r_svc, sizeof(saved->r_svc));
+    memcpy(state->r_abt, saved->r_abt, sizeof(saved->r_abt));
+    memcpy(state->r_irq, saved->r_irq, sizeof(saved->r_irq));
+    memcpy(state->r_und, saved->r_und, sizeof(saved->r_und));
+    state->r15 = saved->r15;
+    state->cpsr = saved->cpsr;
+    state->spsr_fiq = saved->spsr_fiq;
+    state->spsr_svc = saved->spsr_svc;
+    state->spsr_abt = saved->spsr_abt;
+    state->spsr_irq = saved->spsr_irq;
+    state->spsr_und = saved->spsr_und;
+    state->spsr_safe = saved->spsr_safe;
+    ARM_REMAP(state);
+
+    // Prefetch again, without taking steps or cycles, what the saving
+    // CPU had in its pipeline. The cached interpreter has no opcodes.
+    FLUSH;
+    for (int i = 0; i < ahead; i++) {
+        if (cpu->cache == NULL) {
+            cpu->pipeline.opcode[i] = (state->cpsr & CPSR_THUMB) ? MEM_FETCH_16(state->r15) : MEM_FETCH_32(state->r15);
+        }
+        cpu->pipeline.status++;
+        state->r15 += (state->cpsr & CPSR_THUMB) ? SIZE_HWORD : SIZE_WORD;
+    }
+
+    // Decoded blocks may belong to the code which was replaced
+    if (cpu->cache != NULL) {
+        arm_cache_flush(cpu->cache);
+    }
+}
+
+bool arm_load_state(arm_cpu* cpu, FILE* file)
+{
+    arm_saved_state saved;
+
+    if (!arm_read_state(&saved, file)) {
+        return false;
+    }
+    arm_restore_state(cpu, &saved);
+    return true;
+}
@@ -43,6 +43,8 @@ typedef enum {
 typedef int (*cycle_func)(void* object, u32 address, arm_size size, bool write, arm_cycle type);
 typedef u32 (*read_func)(void* object, u32 address);
 typedef void (*write_func)(void* object, u32 address, u32 value);
+typedef u8* (*map_func)(void* object, u32 address, u32 size, bool write);
+typedef void (*watch_func)(void* object, u8* code, u32 size);
 
 typedef enum {
     EXCPT_RESET = 0,
@@ -85,6 +87,8 @@ typedef struct {
     write_func write_byte;
     write_func write_hword;
     write_func write_word;
+    map_func map;
+    watch_func watch;
 } arm_memory;
 
 typedef struct {
@@ -108,6 +112,10 @@ typedef struct {
 
 typedef void (*arm_svc_call)(void* cpu, void* object);
 
+struct arm_cache;
+struct arm_profile;
+struct arm_trace;
+
 typedef struct {
     arm_state* state;
     arm_memory memory;
@@ -125,13 +133,38 @@ typedef struct {
         bool flush;
     } pipeline;
 
+    // Decoded blocks, NULL unless the cached interpreter is used
+    struct arm_cache* cache;
+
+    // Per instruction statistics, NULL unless compiled with ARM_PROFILE
+    struct arm_profile* profile;
+
+    // Last executed instructions, NULL unless compiled with ARM_TRACE
+    struct arm_trace* trace;
+
     int cycles;
 } arm_cpu;
 
+// Bytes written by arm_save_state
+#define ARM_SAVED_STATE_SIZE (sizeof(arm_state) + sizeof(int) + sizeof(u32) + sizeof(int))
+
+// A saved state which has been read but not applied yet
+typedef struct {
+    arm_state state;
+    int ahead; // prefetched instructions
+    u32 base_vector;
+    int cycles;
+} arm_saved_state;
+
 arm_state* arm_make_state();
 arm_cpu* arm_make(arm_version version);
 void arm_free(arm_cpu* cpu);
+void arm_use_cache(arm_cpu* cpu, bool enable);
 void arm_step(arm_cpu* cpu);
 void arm_trigger_irq(arm_cpu* cpu);
+bool arm_save_state(arm_cpu* cpu, FILE* file);
+bool arm_load_state(arm_cpu* cpu, FILE* file);
+bool arm_read_state(arm_saved_state* saved, FILE* file);
+void arm_restore_state(arm_cpu* cpu, const arm_saved_state* saved);
 
 #endif
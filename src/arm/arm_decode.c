@@ -139,4 +139,53 @@ thumb_instruction arm_decode_thumb(u16 instruction)
         return THUMB_19;
     }
     return THUMB_ERROR;
-}
\ No newline at end of file
+}
+
+thumb_fusion arm_fuse_thumb(u16 first, u16 second)
+{
+    if ((first & 0xF800) == 0xF000 && (second & 0xF800) == 0xF800) {
+        // THUMB.19 Long branch with link, both halves
+        return FUSE_BL;
+    }
+
+    if ((second & 0xF000) == 0xD000 && (second & 0xFF00) < 0xDF00) {
+        // CMP immediate, TST, CMP or CMN followed by THUMB.16 Conditional branch
+        if ((first & 0xF800) == 0x2800 ||
+            (first & 0xFFC0) == 0x4200 ||
+            (first & 0xFFC0) == 0x4280 ||
+            (first & 0xFFC0) == 0x42C0) {
+            return FUSE_CMP_BRANCH;
+        }
+        return FUSE_NONE;
+    }
+
+    if ((first & 0xF800) == 0x4800) {
+        // THUMB.6 PC-relative load followed by an ALU operation or
+        // load/store which takes the loaded register as operand
+        int reg = (first >> 8) & 7;
+
+        switch (arm_decode_thumb(second)) {
+        case THUMB_3:
+            if (((second >> 8) & 7) == reg) {
+                return FUSE_LITERAL;
+            }
+            break;
+        case THUMB_1:
+        case THUMB_2:
+        case THUMB_4:
+        case THUMB_5:
+        case THUMB_7:
+        case THUMB_8:
+        case THUMB_9:
+        case THUMB_10:
+            if ((second & 7) == reg || ((second >> 3) & 7) == reg || ((second >> 6) & 7) == reg) {
+                return FUSE_LITERAL;
+            }
+            break;
+        default:
+            break;
+        }
+    }
+
+    return FUSE_NONE;
+}
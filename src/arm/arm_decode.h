@@ -65,7 +65,28 @@ typedef enum {
     THUMB_ERROR
 } thumb_instruction;
 
+// Instruction pairs which are executed as a single operation
+typedef enum {
+    FUSE_NONE,
+    FUSE_BL,         // THUMB.19 prefix + THUMB.19 suffix
+    FUSE_CMP_BRANCH, // THUMB.3/THUMB.4 compare + THUMB.16
+    FUSE_LITERAL     // THUMB.6 + instruction consuming the loaded register
+} thumb_fusion;
+
+// Results of the flag liveness pass
+#define OP_SKIP_FLAGS 1  // N/Z/C/V results are overwritten before being read
+#define OP_STALE_FLAGS 2 // CPSR flags are not up to date after this op
+
+// Pre-decoded instruction
+typedef struct {
+    u32 opcode;
+    u8 type;
+    u8 fusion;
+    u8 flags;
+} arm_op;
+
 arm_instruction arm_decode(u32 instruction);
 thumb_instruction arm_decode_thumb(u16 instruction);
+thumb_fusion arm_fuse_thumb(u16 first, u16 second);
 
 #endif
\ No newline at end of file
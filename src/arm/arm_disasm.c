@@ -0,0 +1,372 @@
+/*
+ * Copyright (C) 2016 Frederic Meyer
+ *
+ * This file is part of NoDS.
+ *
+ * NoDS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * NoDS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NoDS. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "arm_disasm.h"
+#include "arm_decode.h"
+
+static const char* const condition_names[16] = {
+    "eq", "ne", "cs", "cc", "mi", "pl", "vs", "vc",
+    "hi", "ls", "ge", "lt", "gt", "le", "", "nv"
+};
+
+static const char* const register_names[16] = {
+    "r0", "r1", "r2", "r3", "r4", "r5", "r6", "r7",
+    "r8", "r9", "r10", "r11", "r12", "sp", "lr", "pc"
+};
+
+static const char* const shift_names[4] = { "lsl", "lsr", "asr", "ror" };
+
+static const char* const data_processing_names[16] = {
+    "and", "eor", "sub", "rsb", "add", "adc", "sbc", "rsc",
+    "tst", "teq", "cmp", "cmn", "orr", "mov", "bic", "mvn"
+};
+
+static const char* const thumb_alu_names[16] = {
+    "and", "eor", "lsl", "lsr", "asr", "adc", "sbc", "ror",
+    "tst", "neg", "cmp", "cmn", "orr", "mul", "bic", "mvn"
+};
+
+// Appends "r0,r1,r4-r7" for the registers in list
+static void arm_disasm_list(u32 list, char* buffer, size_t size)
+{
+    size_t length = strlen(buffer);
+    bool first = true;
+
+    for (int i = 0; i < 16; i++) {
+        if (list & (1 << i)) {
+            int last = i;
+
+            while (last < 15 && (list & (1 << (last + 1)))) {
+                last++;
+            }
+
+            if (last > i + 1) {
+                length += snprintf(buffer + length, length < size ? size - length : 0, "%s%s-%s",
+                                   first ? "" : ",", register_names[i], register_names[last]);
+                i = last;
+            } else {
+                length += snprintf(buffer + length, length < size ? size - length : 0, "%s%s",
+                                   first ? "" : ",", register_names[i]);
+            }
+            first = false;
+        }
+    }
+}
+
+// Shifted register operand of ARM.8 and ARM.9
+static void arm_disasm_shift(u32 instruction, char* buffer, size_t size)
+{
+    int reg_operand = instruction & 0xF;
+    int shift = (instruction >> 5) & 3;
+
+    if (instruction & (1 << 4)) {
+        snprintf(buffer, size, "%s,%s %s", register_names[reg_operand],
+                 shift_names[shift], register_names[(instruction >> 8) & 0xF]);
+    } else {
+        u32 amount = (instruction >> 7) & 0x1F;
+
+        if (amount == 0 && shift == 0) {
+            snprintf(buffer, size, "%s", register_names[reg_operand]);
+        } else if (amount == 0 && shift == 3) {
+            snprintf(buffer, size, "%s,rrx", register_names[reg_operand]);
+        } else {
+            snprintf(buffer, size, "%s,%s #%u", register_names[reg_operand], shift_names[shift], amount ? amount : 32);
+        }
+    }
+}
+
+void arm_disasm(u32 address, u32 instruction, char* buffer, size_t size)
+{
+    const char* condition = condition_names[instruction >> 28];
+    int reg_dest = (instruction >> 12) & 0xF;
+    int reg_base = (instruction >> 16) & 0xF;
+    char operand[32];
+
+    switch (arm_decode(instruction)) {
+    case ARM_1:
+        if (instruction & (1 << 21)) {
+            snprintf(buffer, size, "mla%s%s %s,%s,%s,%s", condition, instruction & (1 << 20) ? "s" : "",
+                     register_names[reg_base], register_names[instruction & 0xF],
+                     register_names[(instruction >> 8) & 0xF], register_names[reg_dest]);
+        } else {
+            snprintf(buffer, size, "mul%s%s %s,%s,%s", condition, instruction & (1 << 20) ? "s" : "",
+                     register_names[reg_base], register_names[instruction & 0xF],
+                     register_names[(instruction >> 8) & 0xF]);
+        }
+        break;
+    case ARM_2:
+        snprintf(buffer, size, "%s%s%s%s %s,%s,%s,%s", instruction & (1 << 22) ? "s" : "u",
+                 instruction & (1 << 21) ? "mlal" : "mull", condition, instruction & (1 << 20) ? "s" : "",
+                 register_names[reg_dest], register_names[reg_base],
+                 register_names[instruction & 0xF], register_names[(instruction >> 8) & 0xF]);
+        break;
+    case ARM_3:
+        snprintf(buffer, size, "bx%s %s", condition, register_names[instruction & 0xF]);
+        break;
+    case ARM_4:
+        snprintf(buffer, size, "swp%s%s %s,%s,[%s]", condition, instruction & (1 << 22) ? "b" : "",
+                 register_names[reg_dest], register_names[instruction & 0xF], register_names[reg_base]);
+        break;
+    case ARM_5:
+    case ARM_6:
+    case ARM_7: {
+        static const char* const names[4] = { "swp", "h", "sb", "sh" };
+        bool load = instruction & (1 << 20);
+        bool pre_indexed = instruction & (1 << 24);
+        char sign = instruction & (1 << 23) ? '+' : '-';
+
+        if (instruction & (1 << 22)) {
+            snprintf(operand, sizeof(operand), "#%c0x%x", sign, ((instruction >> 4) & 0xF0) | (instruction & 0xF));
+        } else {
+            snprintf(operand, sizeof(operand), "%c%s", sign, register_names[instruction & 0xF]);
+        }
+
+        snprintf(buffer, size, "%s%s%s %s,[%s%s%s%s", load ? "ldr" : "str", condition,
+                 names[(instruction >> 5) & 3], register_names[reg_dest], register_names[reg_base],
+                 pre_indexed ? "," : "],", operand,
+                 pre_indexed ? (instruction & (1 << 21) ? "]!" : "]") : "");
+        break;
+    }
+    case ARM_8: {
+        int opcode = (instruction >> 21) & 0xF;
+        bool set_flags = instruction & (1 << 20);
+
+        if (instruction & (1 << 25)) {
+            u32 immediate_value = instruction & 0xFF;
+            int amount = ((instruction >> 8) & 0xF) << 1;
+            snprintf(operand, sizeof(operand), "#0x%x", (immediate_value >> amount) | (immediate_value << ((32 - amount) & 31)));
+        } else {
+            arm_disasm_shift(instruction, operand, sizeof(operand));
+        }
+
+        // TST, TEQ, CMP and CMN without the s bit are PSR transfers
+        if (!set_flags && opcode >= 0b1000 && opcode <= 0b1011) {
+            const char* psr = instruction & (1 << 22) ? "spsr" : "cpsr";
+
+            if (opcode & 1) {
+                snprintf(buffer, size, "msr%s %s_%s%s%s%s,%s", condition, psr,
+                         instruction & (1 << 19) ? "f" : "", instruction & (1 << 18) ? "s" : "",
+                         instruction & (1 << 17) ? "x" : "", instruction & (1 << 16) ? "c" : "", operand);
+            } else {
+                snprintf(buffer, size, "mrs%s %s,%s", condition, register_names[reg_dest], psr);
+            }
+        } else if (opcode >= 0b1000 && opcode <= 0b1011) {
+            snprintf(buffer, size, "%s%s %s,%s", data_processing_names[opcode], condition,
+                     register_names[reg_base], operand);
+        } else if (opcode == 0b1101 || opcode == 0b1111) {
+            snprintf(buffer, size, "%s%s%s %s,%s", data_processing_names[opcode], condition,
+                     set_flags ? "s" : "", register_names[reg_dest], operand);
+        } else {
+            snprintf(buffer, size, "%s%s%s %s,%s,%s", data_processing_names[opcode], condition,
+                     set_flags ? "s" : "", register_names[reg_dest], register_names[reg_base], operand);
+        }
+        break;
+    }
+    case ARM_9: {
+        bool pre_indexed = instruction & (1 << 24);
+        char sign = instruction & (1 << 23) ? '+' : '-';
+
+        if (instruction & (1 << 25)) {
+            operand[0] = sign;
+            arm_disasm_shift(instruction, operand + 1, sizeof(operand) - 1);
+        } else {
+            snprintf(operand, sizeof(operand), "#%c0x%x", sign, instruction & 0xFFF);
+        }
+
+        snprintf(buffer, size, "%s%s%s%s %s,[%s%s%s%s", instruction & (1 << 20) ? "ldr" : "str", condition,
+                 instruction & (1 << 22) ? "b" : "", !pre_indexed && (instruction & (1 << 21)) ? "t" : "",
+                 register_names[reg_dest], register_names[reg_base], pre_indexed ? "," : "],", operand,
+                 pre_indexed ? (instruction & (1 << 21) ? "]!" : "]") : "");
+
+        // Resolve PC-relative loads
+        if (reg_base == 15 && pre_indexed && !(instruction & (1 << 25))) {
+            u32 offset = instruction & 0xFFF;
+            size_t length = strlen(buffer);
+            snprintf(buffer + length, length < size ? size - length : 0, " ; =0x%08x",
+                     address + 8 + (sign == '+' ? offset : -offset));
+        }
+        break;
+    }
+    case ARM_11: {
+        static const char* const modes[4] = { "da", "ia", "db", "ib" };
+
+        snprintf(buffer, size, "%s%s%s %s%s,{", instruction & (1 << 20) ? "ldm" : "stm", condition,
+                 modes[(instruction >> 23) & 3], register_names[reg_base], instruction & (1 << 21) ? "!" : "");
+        arm_disasm_list(instruction & 0xFFFF, buffer, size);
+        strncat(buffer, instruction & (1 << 22) ? "}^" : "}", size - strlen(buffer) - 1);
+        break;
+    }
+    case ARM_12: {
+        u32 offset = instruction & 0xFFFFFF;
+
+        if (offset & 0x800000) {
+            offset |= 0xFF000000;
+        }
+        snprintf(buffer, size, "b%s%s 0x%08x", instruction & (1 << 24) ? "l" : "", condition, address + 8 + (offset << 2));
+        break;
+    }
+    case ARM_13:
+    case ARM_14:
+    case ARM_15:
+        snprintf(buffer, size, "cp%s p%d ; 0x%08x", condition, (instruction >> 8) & 0xF, instruction);
+        break;
+    case ARM_16:
+        snprintf(buffer, size, "swi%s 0x%x", condition, instruction & 0xFFFFFF);
+        break;
+    default:
+        snprintf(buffer, size, "undefined ; 0x%08x", instruction);
+        break;
+    }
+}
+
+void arm_disasm_thumb(u32 address, u16 instruction, char* buffer, size_t size)
+{
+    int reg_dest = instruction & 7;
+    int reg_source = (instruction >> 3) & 7;
+    int reg_upper = (instruction >> 8) & 7;
+
+    switch (arm_decode_thumb(instruction)) {
+    case THUMB_1:
+        snprintf(buffer, size, "%s %s,%s,#%d", shift_names[(instruction >> 11) & 3],
+                 register_names[reg_dest], register_names[reg_source], (instruction >> 6) & 0x1F);
+        break;
+    case THUMB_2:
+        if (instruction & (1 << 10)) {
+            snprintf(buffer, size, "%s %s,%s,#%d", instruction & (1 << 9) ? "sub" : "add",
+                     register_names[reg_dest], register_names[reg_source], (instruction >> 6) & 7);
+        } else {
+            snprintf(buffer, size, "%s %s,%s,%s", instruction & (1 << 9) ? "sub" : "add",
+                     register_names[reg_dest], register_names[reg_source], register_names[(instruction >> 6) & 7]);
+        }
+        break;
+    case THUMB_3: {
+        static const char* const names[4] = { "mov", "cmp", "add", "sub" };
+        snprintf(buffer, size, "%s %s,#0x%x", names[(instruction >> 11) & 3], register_names[reg_upper], instruction & 0xFF);
+        break;
+    }
+    case THUMB_4:
+        snprintf(buffer, size, "%s %s,%s", thumb_alu_names[(instruction >> 6) & 0xF],
+                 register_names[reg_dest], register_names[reg_source]);
+        break;
+    case THUMB_5: {
+        static const char* const names[4] = { "add", "cmp", "mov", "bx" };
+        int opcode = (instruction >> 8) & 3;
+
+        reg_dest |= (instruction >> 4) & 8;
+        reg_source |= (instruction >> 3) & 8;
+
+        if (opcode == 0b11) {
+            snprintf(buffer, size, "bx %s", register_names[reg_source]);
+        } else {
+            snprintf(buffer, size, "%s %s,%s", names[opcode], register_names[reg_dest], register_names[reg_source]);
+        }
+        break;
+    }
+    case THUMB_6:
+        snprintf(buffer, size, "ldr %s,[pc,#0x%x] ; =0x%08x", register_names[reg_upper],
+                 (instruction & 0xFF) << 2, ((address + 4) & ~3) + ((instruction & 0xFF) << 2));
+        break;
+    case THUMB_7: {
+        static const char* const names[4] = { "str", "strb", "ldr", "ldrb" };
+        snprintf(buffer, size, "%s %s,[%s,%s]", names[(instruction >> 10) & 3], register_names[reg_dest],
+                 register_names[reg_source], register_names[(instruction >> 6) & 7]);
+        break;
+    }
+    case THUMB_8: {
+        static const char* const names[4] = { "strh", "ldsb", "ldrh", "ldsh" };
+        snprintf(buffer, size, "%s %s,[%s,%s]", names[(instruction >> 10) & 3], register_names[reg_dest],
+                 register_names[reg_source], register_names[(instruction >> 6) & 7]);
+        break;
+    }
+    case THUMB_9: {
+        static const char* const names[4] = { "str", "ldr", "strb", "ldrb" };
+        int opcode = (instruction >> 11) & 3;
+        int offset = (instruction >> 6) & 0x1F;
+        snprintf(buffer, size, "%s %s,[%s,#0x%x]", names[opcode], register_names[reg_dest],
+                 register_names[reg_source], opcode < 2 ? offset << 2 : offset);
+        break;
+    }
+    case THUMB_10:
+        snprintf(buffer, size, "%s %s,[%s,#0x%x]", instruction & (1 << 11) ? "ldrh" : "strh",
+                 register_names[reg_dest], register_names[reg_source], ((instruction >> 6) & 0x1F) << 1);
+        break;
+    case THUMB_11:
+        snprintf(buffer, size, "%s %s,[sp,#0x%x]", instruction & (1 << 11) ? "ldr" : "str",
+                 register_names[reg_upper], (instruction & 0xFF) << 2);
+        break;
+    case THUMB_12:
+        snprintf(buffer, size, "add %s,%s,#0x%x", register_names[reg_upper],
+                 instruction & (1 << 11) ? "sp" : "pc", (instruction & 0xFF) << 2);
+        break;
+    case THUMB_13:
+        snprintf(buffer, size, "add sp,#%s0x%x", instruction & (1 << 7) ? "-" : "", (instruction & 0x7F) << 2);
+        break;
+    case THUMB_14: {
+        bool pop = instruction & (1 << 11);
+        u32 list = instruction & 0xFF;
+
+        if (instruction & (1 << 8)) {
+            list |= pop ? (1 << 15) : (1 << 14);
+        }
+        snprintf(buffer, size, "%s {", pop ? "pop" : "push");
+        arm_disasm_list(list, buffer, size);
+        strncat(buffer, "}", size - strlen(buffer) - 1);
+        break;
+    }
+    case THUMB_15:
+        snprintf(buffer, size, "%s %s!,{", instruction & (1 << 11) ? "ldmia" : "stmia", register_names[reg_upper]);
+        arm_disasm_list(instruction & 0xFF, buffer, size);
+        strncat(buffer, "}", size - strlen(buffer) - 1);
+        break;
+    case THUMB_16:
+        snprintf(buffer, size, "b%s 0x%08x", condition_names[(instruction >> 8) & 0xF],
+                 address + 4 + ((s8)(instruction & 0xFF) << 1));
+        break;
+    case THUMB_17:
+        snprintf(buffer, size, "swi 0x%x", instruction & 0xFF);
+        break;
+    case THUMB_18: {
+        u32 offset = (instruction & 0x7FF) << 1;
+
+        if (offset & 0x800) {
+            offset |= 0xFFFFF000;
+        }
+        snprintf(buffer, size, "b 0x%08x", address + 4 + offset);
+        break;
+    }
+    case THUMB_19:
+        // Each half only holds part of the offset
+        if (instruction & (1 << 11)) {
+            snprintf(buffer, size, "bl lr+0x%x", (instruction & 0x7FF) << 1);
+        } else {
+            u32 offset = (instruction & 0x7FF) << 12;
+
+            if (offset & 0x400000) {
+                offset |= 0xFF800000;
+            }
+            snprintf(buffer, size, "bl.prefix lr=0x%08x", address + 4 + offset);
+        }
+        break;
+    default:
+        snprintf(buffer, size, "undefined ; 0x%04x", instruction);
+        break;
+    }
+}
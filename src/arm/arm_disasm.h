@@ -0,0 +1,31 @@
+/*
+ * Copyright (C) 2016 Frederic Meyer
+ *
+ * This file is part of NoDS.
+ *
+ * NoDS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * NoDS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NoDS. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _ARM_DISASM_H_
+#define _ARM_DISASM_H_
+
+#include <stddef.h>
+#include "arm_global.h"
+
+// Write the assembly of the instruction at address to buffer. The
+// address is only used to resolve PC-relative branches and loads.
+void arm_disasm(u32 address, u32 instruction, char* buffer, size_t size);
+void arm_disasm_thumb(u32 address, u16 instruction, char* buffer, size_t size);
+
+#endif
@@ -17,15 +17,15 @@
  * along with NoDS. If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <string.h>
 #include "arm_global.h"
 #include "arm_cpu.h"
 #include "arm_macro.h"
 #include "arm_decode.h"
 
-void arm4_execute(arm_cpu* cpu, u32 instruction)
+void arm4_execute(arm_cpu* cpu, u32 instruction, arm_instruction type)
 {
     arm_state* state = cpu->state;
-    arm_instruction type = arm_decode(instruction);
 
     // Return if the instruction condition is not met
     CONDITION_BREAK(instruction >> 28);
@@ -143,9 +143,9 @@ void arm4_execute(arm_cpu* cpu, u32 instruction)
         u32 memory_value;
 
         // Single Data Swap instructions may not use r15
-        ASSERT(reg_source == 15, LOG_ERROR, "ARM.4 rSRC=15, r15=%x", state->r15);
-        ASSERT(reg_dest == 15, LOG_ERROR, "ARM.4 rDST=15, r15=%x", state->r15);
-        ASSERT(reg_base == 15, LOG_ERROR, "ARM.4 rBSE=15, r15=%x", state->r15);
+        ASSERT(reg_source == 15, LOG_CPU, LOG_ERROR, "ARM.4 rSRC=15, r15=%x", state->r15);
+        ASSERT(reg_dest == 15, LOG_CPU, LOG_ERROR, "ARM.4 rDST=15, r15=%x", state->r15);
+        ASSERT(reg_base == 15, LOG_CPU, LOG_ERROR, "ARM.4 rBSE=15, r15=%x", state->r15);
 
         // If the swap bit is set the byte at *rBSE
         // get overwritten with the LSB of rSRC and
@@ -186,15 +186,15 @@ void arm4_execute(arm_cpu* cpu, u32 instruction)
         u32 offset;
 
         // Writeback may not be enabled when rBSE=15
-        ASSERT(reg_base == 15 && write_back, LOG_ERROR,
+        ASSERT(reg_base == 15 && write_back, LOG_CPU, LOG_ERROR,
                "ARM.5-7: writeback to r15, r15=0x%x", state->r15);
 
         // Writeback may not be enabled in post-indexed mode
-        ASSERT(write_back && !pre_indexed, LOG_ERROR,
+        ASSERT(write_back && !pre_indexed, LOG_CPU, LOG_ERROR,
                "ARM.5-7: writeback in post-indexed mode, r15=0x%x", state->r15);
 
         // Signed mode is only capable when loading
-        ASSERT(type == ARM_7 && !load, LOG_ERROR,
+        ASSERT(type == ARM_7 && !load, LOG_CPU, LOG_ERROR,
                "ARM.7: Storing in signed mode, r15=0x%x", state->r15);
 
         // If the instruction is immediate take an 8-bit
@@ -206,7 +206,7 @@ void arm4_execute(arm_cpu* cpu, u32 instruction)
             int reg_offset = instruction & 0xF;
 
             // Using r15 as offset is strictly disallowed
-            ASSERT(reg_offset == 15, LOG_ERROR,
+            ASSERT(reg_offset == 15, LOG_CPU, LOG_ERROR,
                    "ARM.5-7: rOFS=15, r15=0x%x", state->r15);
 
             offset = REG(reg_offset);
@@ -571,8 +571,8 @@ void arm4_execute(arm_cpu* cpu, u32 instruction)
         u32 address = REG(reg_base);
 
         // Instructions neither write back if base register is r15 nor should they have the write-back bit set when being post-indexed (post-indexing automatically writes back the address)
-        ASSERT(reg_base == 15 && write_back, LOG_WARN, "Single Data Transfer, thou shall not writeback to r15, r15=0x%x", state->r15);
-        ASSERT(write_back && !pre_indexed, LOG_WARN, "Single Data Transfer, thou shall not have write-back bit if being post-indexed, r15=0x%x", state->r15);
+        ASSERT(reg_base == 15 && write_back, LOG_CPU, LOG_WARN, "Single Data Transfer, thou shall not writeback to r15, r15=0x%x", state->r15);
+        ASSERT(write_back && !pre_indexed, LOG_CPU, LOG_WARN, "Single Data Transfer, thou shall not have write-back bit if being post-indexed, r15=0x%x", state->r15);
 
         // The offset added to the base address can either be an 12 bit immediate value or a register shifted by 5 bit immediate value
         if (immediate) {
@@ -583,7 +583,7 @@ void arm4_execute(arm_cpu* cpu, u32 instruction)
             int shift = (instruction >> 5) & 3;
             bool carry;
 
-            ASSERT(reg_offset == 15, LOG_WARN, "Single Data Transfer, thou shall not use r15 as offset, r15=0x%x", state->r15);
+            ASSERT(reg_offset == 15, LOG_CPU, LOG_WARN, "Single Data Transfer, thou shall not use r15 as offset, r15=0x%x", state->r15);
 
             offset = REG(reg_offset);
 
@@ -664,7 +664,7 @@ void arm4_execute(arm_cpu* cpu, u32 instruction)
     }
     case ARM_10:
         // ARM.10 Undefined
-        LOG(LOG_ERROR, "Undefined instruction (0x%x), r15=0x%x", instruction, state->r15);
+        LOG(LOG_CPU, LOG_ERROR, "Undefined instruction (0x%x), r15=0x%x", instruction, state->r15);
         return;
     case ARM_11:
     {
@@ -681,17 +681,63 @@ void arm4_execute(arm_cpu* cpu, u32 instruction)
         bool pre_indexed = instruction & (1 << 24);
         u32 address = REG(reg_base);
         u32 old_address = address;
+        u16 register_list = instruction & 0xFFFF;
+        int register_count = __builtin_popcount(register_list);
         bool switched_mode = false;
         int old_mode;
         int first_register = 0;
 
         // Base register must not be r15
-        ASSERT(reg_base == 15, LOG_WARN, "Block Data Tranfser, thou shall not take r15 as base register, r15=0x%x", state->r15);
+        ASSERT(reg_base == 15, LOG_CPU, LOG_WARN, "Block Data Tranfser, thou shall not take r15 as base register, r15=0x%x", state->r15);
+
+        if (register_count != 0) {
+            // The lowest register always is transferred to the lowest address
+            u32 start = add_to_base ? address : address - register_count * 4;
+            if (pre_indexed == add_to_base) {
+                start += 4;
+            }
+
+            // Sync the whole transfer at once
+            SYNC_BURST(start, register_count, !load);
+
+            // Fast path: if the transfer lies completely inside directly mapped RAM
+            // copy between the register file and host memory. User bank transfers and
+            // writeback of a listed base register are left to the generic code below.
+            if (!s_bit && reg_base != 15 && !(write_back && (register_list & (1 << reg_base)))) {
+                u8* memory = MEM_MAP(start & ~3, register_count * 4, !load);
+
+                if (memory != NULL) {
+                    for (int i = 0; i < 16; i++) {
+                        if (register_list & (1 << i)) {
+                            if (load) {
+                                u32 value;
+                                memcpy(&value, memory, sizeof(u32));
+                                REG(i) = value;
+                            } else {
+                                u32 value = REG(i);
+                                memcpy(memory, &value, sizeof(u32));
+                            }
+                            memory += 4;
+                        }
+                    }
+
+                    if (write_back) {
+                        REG(reg_base) = add_to_base ? address + register_count * 4 : address - register_count * 4;
+                    }
+
+                    // Loading r15 flushes the pipeline
+                    if (load && (register_list & (1 << 15))) {
+                        cpu->pipeline.flush = true;
+                    }
+                    return;
+                }
+            }
+        }
 
         // If the s bit is set and the instruction is either a store or r15 is not in the list switch to user mode
         if (s_bit && (!load || !pc_in_list)) {
             // Writeback must not be activated in this case
-            ASSERT(write_back, LOG_WARN, "Block Data Transfer, thou shall not do user bank transfer with writeback, r15=0x%x", state->r15);
+            ASSERT(write_back, LOG_CPU, LOG_WARN, "Block Data Transfer, thou shall not do user bank transfer with writeback, r15=0x%x", state->r15);
 
             // Save current mode and enter user mode
             old_mode = state->cpsr & 0x1F;
@@ -737,7 +783,7 @@ void arm4_execute(arm_cpu* cpu, u32 instruction)
                             // If the s bit is set a mode switch is performed
                             if (s_bit) {
                                 // spsr_<mode> must not be copied to cpsr in user mode because user mode has not such a register
-                                ASSERT((state->cpsr & 0x1F) == MODE_USR, LOG_ERROR, "Block Data Transfer is about to copy spsr_<mode> to cpsr, however we are in user mode, r15=0x%x", state->r15);
+                                ASSERT((state->cpsr & 0x1F) == MODE_USR, LOG_CPU, LOG_ERROR, "Block Data Transfer is about to copy spsr_<mode> to cpsr, however we are in user mode, r15=0x%x", state->r15);
 
                                 state->cpsr = *state->spsr_ptr;
                                 ARM_REMAP(state);
@@ -788,7 +834,7 @@ void arm4_execute(arm_cpu* cpu, u32 instruction)
                             // If the s bit is set a mode switch is performed
                             if (s_bit) {
                                 // spsr_<mode> must not be copied to cpsr in user mode because user mode has no such a register
-                                ASSERT((state->cpsr & CPSR_MODE) == MODE_USR, LOG_ERROR, "Block Data Transfer is about to copy spsr_<mode> to cpsr, however we are in user mode, r15=0x%x", state->r15);
+                                ASSERT((state->cpsr & CPSR_MODE) == MODE_USR, LOG_CPU, LOG_ERROR, "Block Data Transfer is about to copy spsr_<mode> to cpsr, however we are in user mode, r15=0x%x", state->r15);
 
                                 state->cpsr = *state->spsr_ptr;
                                 ARM_REMAP(state);
@@ -840,15 +886,15 @@ void arm4_execute(arm_cpu* cpu, u32 instruction)
     }
     case ARM_13:
         // ARM.13 Coprocessor data transfer
-        LOG(LOG_ERROR, "Unimplemented coprocessor data transfer, r15=0x%x", state->r15);
+        LOG(LOG_CPU, LOG_ERROR, "Unimplemented coprocessor data transfer, r15=0x%x", state->r15);
         return;
     case ARM_14:
         // ARM.14 Coprocessor data operation
-        LOG(LOG_ERROR, "Unimplemented coprocessor data operation, r15=0x%x", state->r15);
+        LOG(LOG_CPU, LOG_ERROR, "Unimplemented coprocessor data operation, r15=0x%x", state->r15);
         return;
     case ARM_15:
         // ARM.15 Coprocessor register transfer
-        LOG(LOG_ERROR, "Unimplemented coprocessor register transfer, r15=0x%x", state->r15);
+        LOG(LOG_CPU, LOG_ERROR, "Unimplemented coprocessor register transfer, r15=0x%x", state->r15);
         return;
     case ARM_16:
         // ARM.16 Software interrupt
@@ -21,13 +21,38 @@
 #define _ARM_MACRO_H_
 
 #include "arm_global.h"
-
+#include "arm_trace.h"
+
+#ifdef ARM_TRACE
+// Data accesses are attached to the trace entry of the current instruction
+#define MEM_READ_8(address) arm_trace_access(cpu->trace, address, cpu->memory.read_byte(cpu->memory.object, address), TRACE_READ)
+#define MEM_READ_16(address) arm_trace_access(cpu->trace, address, cpu->memory.read_hword(cpu->memory.object, (address) & ~1), TRACE_READ)
+#define MEM_READ_32(address) arm_trace_access(cpu->trace, address, cpu->memory.read_word(cpu->memory.object, (address) & ~3), TRACE_READ)
+#define MEM_WRITE_8(address, value) cpu->memory.write_byte(cpu->memory.object, address, arm_trace_access(cpu->trace, address, value, TRACE_WRITE))
+#define MEM_WRITE_16(address, value) cpu->memory.write_hword(cpu->memory.object, (address) & ~1, arm_trace_access(cpu->trace, address, value, TRACE_WRITE))
+#define MEM_WRITE_32(address, value) cpu->memory.write_word(cpu->memory.object, (address) & ~3, arm_trace_access(cpu->trace, address, value, TRACE_WRITE))
+#else
 #define MEM_READ_8(address) cpu->memory.read_byte(cpu->memory.object, address)
 #define MEM_READ_16(address) cpu->memory.read_hword(cpu->memory.object, (address) & ~1)
 #define MEM_READ_32(address) cpu->memory.read_word(cpu->memory.object, (address) & ~3)
 #define MEM_WRITE_8(address, value) cpu->memory.write_byte(cpu->memory.object, address, value)
 #define MEM_WRITE_16(address, value) cpu->memory.write_hword(cpu->memory.object, (address) & ~1, value)
 #define MEM_WRITE_32(address, value) cpu->memory.write_word(cpu->memory.object, (address) & ~3, value)
+#endif
+
+// Instruction fetches
+#define MEM_FETCH_16(address) cpu->memory.read_hword(cpu->memory.object, (address) & ~1)
+#define MEM_FETCH_32(address) cpu->memory.read_word(cpu->memory.object, (address) & ~3)
+
+// Returns a host pointer if [address, address + size) is directly mapped RAM, otherwise NULL
+#define MEM_MAP(address, size, write) (cpu->memory.map != NULL ? cpu->memory.map(cpu->memory.object, address, size, write) : NULL)
+
+// Asks the memory to report writes to [code, code + size), which holds decoded instructions
+#define MEM_WATCH(code, size) {\
+    if (cpu->memory.watch != NULL) {\
+        cpu->memory.watch(cpu->memory.object, code, size);\
+    }\
+}
 
 #define FLUSH cpu->pipeline.status = 0;\
               cpu->pipeline.flush = false;
@@ -193,4 +218,11 @@
     cpu->cycles += cycles;\
 }
 
+// Syncs a block transfer of count words at once (1N + (count-1)S)
+#define SYNC_BURST(address, count, write) {\
+    int cycles = cpu->memory.cycles(cpu->memory.object, address, SIZE_WORD, write, CYCLE_N) +\
+                 ((count) - 1) * cpu->memory.cycles(cpu->memory.object, address, SIZE_WORD, write, CYCLE_S);\
+    cpu->cycles += (count) + cycles;\
+}
+
 #endif
@@ -0,0 +1,347 @@
+/*
+ * Copyright (C) 2016 Frederic Meyer
+ *
+ * This file is part of NoDS.
+ *
+ * NoDS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * NoDS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NoDS. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "common/hash.h"
+#include "arm_profile.h"
+
+#define PROFILE_INITIAL_CAPACITY 4096
+
+arm_profile* arm_profile_make()
+{
+    arm_profile* profile = calloc(1, sizeof(arm_profile));
+
+    profile->capacity = PROFILE_INITIAL_CAPACITY;
+    profile->entries = calloc(profile->capacity, sizeof(arm_profile_entry));
+
+    return profile;
+}
+
+void arm_profile_free(arm_profile* profile)
+{
+    free(profile->entries);
+    free(profile->callstack.samples);
+    free(profile->callstack.overflow);
+    free(profile);
+}
+
+// Open addressing, empty slots have a zero count
+static arm_profile_entry* arm_profile_find(arm_profile_entry* entries, u32 capacity, u32 address)
+{
+    u32 index = (address * 0x9E3779B1) & (capacity - 1);
+
+    while (entries[index].count != 0 && entries[index].address != address) {
+        index = (index + 1) & (capacity - 1);
+    }
+
+    return &entries[index];
+}
+
+static void arm_profile_grow(arm_profile* profile)
+{
+    u32 capacity = profile->capacity * 2;
+    arm_profile_entry* entries = calloc(capacity, sizeof(arm_profile_entry));
+
+    for (u32 i = 0; i < profile->capacity; i++) {
+        if (profile->entries[i].count != 0) {
+            *arm_profile_find(entries, capacity, profile->entries[i].address) = profile->entries[i];
+        }
+    }
+
+    free(profile->entries);
+    profile->entries = entries;
+    profile->capacity = capacity;
+}
+
+static arm_stack_sample* arm_callstack_find(arm_stack_sample* samples, u32 capacity, arm_stack_sample* stack)
+{
+    u32 index = stack->hash & (capacity - 1);
+
+    while (samples[index].cycles != 0 && (samples[index].hash != stack->hash || samples[index].depth != stack->depth ||
+           memcmp(samples[index].functions, stack->functions, stack->depth * sizeof(u32)) != 0)) {
+        index = (index + 1) & (capacity - 1);
+    }
+
+    return &samples[index];
+}
+
+// Attributes the cycles since the last sample to the current call stack
+static void arm_callstack_sample(arm_profile* profile)
+{
+    arm_stack_sample stack;
+    arm_stack_sample* sample;
+
+    stack.depth = profile->callstack.depth < CALLSTACK_DEPTH ? profile->callstack.depth : CALLSTACK_DEPTH;
+    for (int i = 0; i < stack.depth; i++) {
+        stack.functions[i] = profile->callstack.frames[i].function;
+    }
+    stack.hash = hash_fnv1a(HASH_FNV_BASIS, stack.functions, stack.depth * sizeof(u32));
+
+    if (profile->callstack.samples == NULL) {
+        profile->callstack.capacity = PROFILE_INITIAL_CAPACITY;
+        profile->callstack.samples = calloc(profile->callstack.capacity, sizeof(arm_stack_sample));
+    }
+
+    sample = arm_callstack_find(profile->callstack.samples, profile->callstack.capacity, &stack);
+
+    if (sample->cycles == 0) {
+        // Keep the table at most half full
+        if (++profile->callstack.used > profile->callstack.capacity / 2) {
+            u32 capacity = profile->callstack.capacity * 2;
+            arm_stack_sample* samples = calloc(capacity, sizeof(arm_stack_sample));
+
+            for (u32 i = 0; i < profile->callstack.capacity; i++) {
+                if (profile->callstack.samples[i].cycles != 0) {
+                    *arm_callstack_find(samples, capacity, &profile->callstack.samples[i]) = profile->callstack.samples[i];
+                }
+            }
+
+            free(profile->callstack.samples);
+            profile->callstack.samples = samples;
+            profile->callstack.capacity = capacity;
+            sample = arm_callstack_find(samples, capacity, &stack);
+        }
+        *sample = stack;
+        sample->cycles = 0;
+    }
+
+    sample->cycles += profile->callstack.elapsed;
+    profile->callstack.elapsed = 0;
+}
+
+static void arm_callstack_push(arm_profile* profile, u32 function, u32 return_address)
+{
+    int depth = profile->callstack.depth;
+
+    if (depth < CALLSTACK_DEPTH) {
+        arm_frame* frame = &profile->callstack.frames[depth];
+        frame->function = function;
+        frame->return_address = return_address;
+    } else if (depth < CALLSTACK_DEPTH + CALLSTACK_OVERFLOW) {
+        if (profile->callstack.overflow == NULL) {
+            profile->callstack.overflow = malloc(CALLSTACK_OVERFLOW * sizeof(u32));
+        }
+        profile->callstack.overflow[depth - CALLSTACK_DEPTH] = return_address;
+    } else {
+        return;
+    }
+    profile->callstack.depth++;
+}
+
+// Unwinds up to the frame returning to address. Returns to addresses
+// not on the stack (e.g. from exception handlers) are ignored.
+static void arm_callstack_pop(arm_profile* profile, u32 address)
+{
+    for (int i = profile->callstack.depth - 1; i >= 0; i--) {
+        u32 return_address = i < CALLSTACK_DEPTH ? profile->callstack.frames[i].return_address
+                                                 : profile->callstack.overflow[i - CALLSTACK_DEPTH];
+
+        if (return_address == address) {
+            profile->callstack.depth = i;
+            return;
+        }
+    }
+}
+
+// Detects calls (BL, BX with LR pointing after it) and returns (BX LR,
+// POP {PC}, LDM with r15) among the instructions which took a branch.
+static void arm_callstack_update(arm_cpu* cpu, u32 address, u32 instruction, bool thumb, int type)
+{
+    arm_state* state = cpu->state;
+    arm_profile* profile = cpu->profile;
+    u32 link = *state->r_ptr[14] & ~1;
+    u32 target = state->r15 & ~1;
+    int size = thumb ? SIZE_HWORD : SIZE_WORD;
+
+    if (!cpu->pipeline.flush) {
+        return;
+    }
+
+    if (thumb) {
+        switch (type) {
+        case THUMB_5:
+            // BX
+            if (((instruction >> 8) & 3) == 0b11) {
+                int reg_source = (instruction >> 3) & 0xF;
+                if (reg_source == 14) {
+                    arm_callstack_pop(profile, target);
+                } else if (link == address + size) {
+                    arm_callstack_push(profile, target, link);
+                }
+            }
+            break;
+        case THUMB_14:
+            arm_callstack_pop(profile, target);
+            break;
+        case THUMB_19:
+            // Second half
+            if (instruction & (1 << 11)) {
+                arm_callstack_push(profile, target, link);
+            }
+            break;
+        default:
+            break;
+        }
+    } else {
+        switch (type) {
+        case ARM_3:
+            if ((instruction & 0xF) == 14) {
+                arm_callstack_pop(profile, target);
+            } else if (link == address + size) {
+                arm_callstack_push(profile, target, link);
+            }
+            break;
+        case ARM_11:
+            arm_callstack_pop(profile, target);
+            break;
+        case ARM_12:
+            if (instruction & (1 << 24)) {
+                arm_callstack_push(profile, target, link);
+            }
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+void arm_profile_record(arm_cpu* cpu, u32 address, u32 instruction, bool thumb, int type, int cycles)
+{
+    arm_profile* profile = cpu->profile;
+    arm_profile_entry* entry;
+
+    // The cycles belong to the stack before a call or return
+    profile->callstack.elapsed += cycles;
+    if (profile->callstack.elapsed >= CALLSTACK_PERIOD) {
+        arm_callstack_sample(profile);
+    }
+    arm_callstack_update(cpu, address, instruction, thumb, type);
+
+    if (thumb) {
+        address |= 1;
+        profile->thumb_class[type].count++;
+        profile->thumb_class[type].cycles += cycles;
+    } else {
+        profile->arm_class[type].count++;
+        profile->arm_class[type].cycles += cycles;
+    }
+
+    entry = arm_profile_find(profile->entries, profile->capacity, address);
+
+    if (entry->count == 0) {
+        // Keep the table at most half full
+        if (++profile->used > profile->capacity / 2) {
+            arm_profile_grow(profile);
+            entry = arm_profile_find(profile->entries, profile->capacity, address);
+        }
+        entry->address = address;
+        entry->type = type;
+    }
+
+    entry->count++;
+    entry->cycles += cycles;
+}
+
+static int arm_profile_compare(const void* a, const void* b)
+{
+    const arm_profile_entry* entry_a = a;
+    const arm_profile_entry* entry_b = b;
+
+    if (entry_a->cycles != entry_b->cycles) {
+        return entry_a->cycles > entry_b->cycles ? -1 : 1;
+    }
+    return 0;
+}
+
+void arm_profile_report(arm_profile* profile, FILE* file)
+{
+    arm_profile_entry* sorted = malloc(profile->used * sizeof(arm_profile_entry));
+    u64 total = 0;
+    u32 count = 0;
+
+    for (u32 i = 0; i < profile->capacity; i++) {
+        if (profile->entries[i].count != 0) {
+            total += profile->entries[i].cycles;
+            sorted[count++] = profile->entries[i];
+        }
+    }
+
+    qsort(sorted, count, sizeof(arm_profile_entry), arm_profile_compare);
+
+    fprintf(file, "Hot spots (%u addresses, %llu cycles):\n", count, (unsigned long long)total);
+    fprintf(file, "  address     mode   class      count        cycles   %%\n");
+
+    for (u32 i = 0; i < count && i < PROFILE_REPORT_LENGTH; i++) {
+        arm_profile_entry* entry = &sorted[i];
+        bool thumb = entry->address & 1;
+
+        fprintf(file, "  0x%08x  %-5s  %-6s%-2d %12llu  %12llu  %5.2f\n",
+                entry->address & ~1, thumb ? "THUMB" : "ARM", thumb ? "THUMB." : "ARM.", entry->type + 1,
+                (unsigned long long)entry->count, (unsigned long long)entry->cycles,
+                total != 0 ? 100.0 * entry->cycles / total : 0.0);
+    }
+
+    // Instruction classes, the enums start at ARM.1 and THUMB.1.
+    // Undefined instructions are listed as ARM.17 and THUMB.20.
+    fprintf(file, "Instruction classes:\n");
+    for (int i = 0; i <= ARM_ERROR; i++) {
+        if (profile->arm_class[i].count != 0) {
+            fprintf(file, "  ARM.%-2d    %12llu  %12llu\n", i + 1,
+                    (unsigned long long)profile->arm_class[i].count, (unsigned long long)profile->arm_class[i].cycles);
+        }
+    }
+    for (int i = 0; i <= THUMB_ERROR; i++) {
+        if (profile->thumb_class[i].count != 0) {
+            fprintf(file, "  THUMB.%-2d  %12llu  %12llu\n", i + 1,
+                    (unsigned long long)profile->thumb_class[i].count, (unsigned long long)profile->thumb_class[i].cycles);
+        }
+    }
+
+    free(sorted);
+}
+
+static void arm_profile_write_function(FILE* file, u32 address, elf_symbols* symbols)
+{
+    elf_symbol* symbol = symbols != NULL ? elf_find_symbol(symbols, address) : NULL;
+
+    if (symbol != NULL && symbol->address == address) {
+        fprintf(file, ";%s", symbol->name);
+    } else if (symbol != NULL) {
+        fprintf(file, ";%s+0x%x", symbol->name, address - symbol->address);
+    } else {
+        fprintf(file, ";0x%08x", address);
+    }
+}
+
+// One line per call stack: "[entry];outer;...;inner cycles", as read by flamegraph.pl
+void arm_profile_write_folded(arm_profile* profile, FILE* file, elf_symbols* symbols)
+{
+    for (u32 i = 0; i < profile->callstack.capacity; i++) {
+        arm_stack_sample* sample = &profile->callstack.samples[i];
+
+        if (sample->cycles != 0) {
+            fprintf(file, "[entry]");
+            for (int j = 0; j < sample->depth; j++) {
+                arm_profile_write_function(file, sample->functions[j], symbols);
+            }
+            fprintf(file, " %llu\n", (unsigned long long)sample->cycles);
+        }
+    }
+}
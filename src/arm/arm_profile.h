@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) 2016 Frederic Meyer
+ *
+ * This file is part of NoDS.
+ *
+ * NoDS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * NoDS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NoDS. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _ARM_PROFILE_H_
+#define _ARM_PROFILE_H_
+
+#include "arm_global.h"
+#include "arm_cpu.h"
+#include "arm_decode.h"
+#include "common/elf_symbols.h"
+
+// Counts executions and cycles per guest instruction and samples a shadow
+// call stack. Only compiled in with ARM_PROFILE (make PROFILE=1), otherwise
+// it costs nothing.
+
+#define PROFILE_REPORT_LENGTH 50
+
+#define CALLSTACK_DEPTH 64
+#define CALLSTACK_OVERFLOW 0x10000 // return addresses kept above CALLSTACK_DEPTH
+#define CALLSTACK_PERIOD 1024 // cycles between two samples
+
+typedef struct {
+    u32 function;
+    u32 return_address;
+} arm_frame;
+
+typedef struct {
+    u64 hash;
+    u64 cycles;
+    int depth;
+    u32 functions[CALLSTACK_DEPTH];
+} arm_stack_sample;
+
+typedef struct {
+    u32 address; // bit 0 is set for THUMB instructions
+    u8 type;
+    u64 count;
+    u64 cycles;
+} arm_profile_entry;
+
+typedef struct arm_profile {
+    arm_profile_entry* entries;
+    u32 capacity;
+    u32 used;
+
+    struct {
+        u64 count;
+        u64 cycles;
+    } arm_class[ARM_ERROR + 1], thumb_class[THUMB_ERROR + 1];
+
+    // Calls deeper than CALLSTACK_DEPTH only keep their return address,
+    // so that returns still pop the right frame. Calls deeper than that
+    // are ignored, as are their returns.
+    struct {
+        arm_frame frames[CALLSTACK_DEPTH];
+        u32* overflow;
+        int depth;
+        int elapsed;
+        arm_stack_sample* samples;
+        u32 capacity;
+        u32 used;
+    } callstack;
+} arm_profile;
+
+#ifdef ARM_PROFILE
+#define PROFILE_EXECUTE(call, address, instruction, thumb, type) {\
+    int _cycles = cpu->cycles;\
+    u32 _address = address;\
+    call;\
+    arm_profile_record(cpu, _address, instruction, thumb, type, cpu->cycles - _cycles);\
+}
+#else
+#define PROFILE_EXECUTE(call, address, instruction, thumb, type) call;
+#endif
+
+arm_profile* arm_profile_make();
+void arm_profile_free(arm_profile* profile);
+void arm_profile_record(arm_cpu* cpu, u32 address, u32 instruction, bool thumb, int type, int cycles);
+void arm_profile_report(arm_profile* profile, FILE* file);
+void arm_profile_write_folded(arm_profile* profile, FILE* file, elf_symbols* symbols);
+
+#endif
@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) 2016 Frederic Meyer
+ *
+ * This file is part of NoDS.
+ *
+ * NoDS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * NoDS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NoDS. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <unistd.h>
+#include "arm_trace.h"
+
+arm_trace* arm_trace_make()
+{
+    arm_trace* trace = calloc(1, sizeof(arm_trace));
+    trace->entries = calloc(TRACE_LENGTH, sizeof(arm_trace_entry));
+    return trace;
+}
+
+void arm_trace_free(arm_trace* trace)
+{
+    free(trace->entries);
+    free(trace);
+}
+
+static bool arm_trace_write(int fd, void* data, size_t size)
+{
+    u8* bytes = data;
+
+    while (size != 0) {
+        ssize_t written = write(fd, bytes, size);
+
+        if (written <= 0) {
+            return false;
+        }
+        bytes += written;
+        size -= written;
+    }
+
+    return true;
+}
+
+// Writes the entries oldest first. Only uses write() so
+// that it can be called from a signal handler on a crash.
+bool arm_trace_dump(arm_trace* trace, int fd)
+{
+    u64 count = trace->position < TRACE_LENGTH ? trace->position : TRACE_LENGTH;
+    u64 first = (trace->position - count) & (TRACE_LENGTH - 1);
+    arm_trace_header header = {
+        .magic = "NDST",
+        .version = TRACE_VERSION,
+        .count = count,
+        .entry_size = sizeof(arm_trace_entry)
+    };
+
+    if (!arm_trace_write(fd, &header, sizeof(header))) {
+        return false;
+    }
+
+    // The ring buffer may wrap around
+    if (first + count > TRACE_LENGTH) {
+        return arm_trace_write(fd, &trace->entries[first], (TRACE_LENGTH - first) * sizeof(arm_trace_entry)) &&
+               arm_trace_write(fd, trace->entries, (first + count - TRACE_LENGTH) * sizeof(arm_trace_entry));
+    }
+
+    return arm_trace_write(fd, &trace->entries[first], count * sizeof(arm_trace_entry));
+}
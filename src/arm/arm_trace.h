@@ -0,0 +1,89 @@
+/*
+ * Copyright (C) 2016 Frederic Meyer
+ *
+ * This file is part of NoDS.
+ *
+ * NoDS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * NoDS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NoDS. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _ARM_TRACE_H_
+#define _ARM_TRACE_H_
+
+#include "arm_global.h"
+
+// Binary record of the last TRACE_LENGTH executed instructions. Only
+// compiled in with ARM_TRACE (make TRACE=1), otherwise it costs nothing.
+
+#define TRACE_LENGTH (1 << 22)
+#define TRACE_VERSION 1
+
+typedef enum {
+    TRACE_NONE = 0,
+    TRACE_READ = 1,
+    TRACE_WRITE = 2
+} arm_trace_kind;
+
+typedef struct {
+    u32 address;
+    u32 opcode;
+    u32 cpsr;
+    u32 mem_address; // last data access of the instruction
+    u32 mem_value;
+    u32 mem_access;
+} arm_trace_entry;
+
+typedef struct {
+    char magic[4];
+    u32 version;
+    u32 count;
+    u32 entry_size;
+} arm_trace_header;
+
+typedef struct arm_trace {
+    arm_trace_entry* entries;
+    u64 position; // total number of recorded instructions
+} arm_trace;
+
+#ifdef ARM_TRACE
+#define TRACE_EXECUTE(address, instruction) arm_trace_record(cpu->trace, address, instruction, cpu->state->cpsr);
+#else
+#define TRACE_EXECUTE(address, instruction)
+#endif
+
+static inline void arm_trace_record(arm_trace* trace, u32 address, u32 opcode, u32 cpsr)
+{
+    arm_trace_entry* entry = &trace->entries[trace->position++ & (TRACE_LENGTH - 1)];
+
+    entry->address = address;
+    entry->opcode = opcode;
+    entry->cpsr = cpsr;
+    entry->mem_access = TRACE_NONE;
+}
+
+// Attaches a data access to the instruction recorded last
+static inline u32 arm_trace_access(arm_trace* trace, u32 address, u32 value, arm_trace_kind access)
+{
+    arm_trace_entry* entry = &trace->entries[(trace->position - 1) & (TRACE_LENGTH - 1)];
+
+    entry->mem_address = address;
+    entry->mem_value = value;
+    entry->mem_access = access;
+    return value;
+}
+
+arm_trace* arm_trace_make();
+void arm_trace_free(arm_trace* trace);
+bool arm_trace_dump(arm_trace* trace, int fd);
+
+#endif
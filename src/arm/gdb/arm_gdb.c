@@ -10,7 +10,7 @@ arm_gdb* arm_gdb_make(arm_cpu* arm, int port)
     // Create the underlying socket
     gdb->socket = socket(AF_INET, SOCK_STREAM, 0);
     if (gdb->socket < 0) {
-        LOG(LOG_ERROR, "Cannot create socket.");
+        LOG(LOG_HOST, LOG_ERROR, "Cannot create socket.");
     }
 
     // Setup server address
@@ -22,10 +22,10 @@ arm_gdb* arm_gdb_make(arm_cpu* arm, int port)
     // Bind server address to socket
     if (bind(gdb->socket, (struct sockaddr*)&gdb->server,
              sizeof(struct sockaddr_in)) < 0) {
-        LOG(LOG_ERROR, "Cannot bind on port %d", port);
+        LOG(LOG_HOST, LOG_ERROR, "Cannot bind on port %d", port);
     }
 
-    LOG(LOG_INFO, "Wait for GDB client on 127.0.0.1:%d", port);
+    LOG(LOG_HOST, LOG_INFO, "Wait for GDB client on 127.0.0.1:%d", port);
 
     // Start to listen and accept client
     listen(gdb->socket, 1);
@@ -35,7 +35,7 @@ arm_gdb* arm_gdb_make(arm_cpu* arm, int port)
     // Assign processor to the gdb stub
     gdb->arm = arm;
 
-    LOG(LOG_INFO, "Connection established.");
+    LOG(LOG_HOST, LOG_INFO, "Connection established.");
 
     return gdb;
 }
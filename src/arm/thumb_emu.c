@@ -17,15 +17,16 @@
  * along with NoDS. If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <string.h>
 #include "arm_global.h"
 #include "arm_cpu.h"
 #include "arm_macro.h"
 #include "arm_decode.h"
 
-void arm4_execute_thumb(arm_cpu* cpu, u16 instruction)
+void arm4_execute_thumb(arm_cpu* cpu, u16 instruction, thumb_instruction type)
 {
     arm_state* state = cpu->state;
-    switch (arm_decode_thumb(instruction)) {
+    switch (type) {
     case THUMB_1: {
         // THUMB.1 Move shifted register
         int reg_dest = instruction & 7;
@@ -553,7 +554,57 @@ void arm4_execute_thumb(arm_cpu* cpu, u16 instruction)
     }
     case THUMB_14: {
         // THUMB.14 push/pop registers
-        if (instruction & (1 << 11)) { // POP
+        bool pop = instruction & (1 << 11);
+        bool lr_pc = instruction & (1 << 8);
+        int register_count = __builtin_popcount(instruction & 0xFF) + (lr_pc ? 1 : 0);
+
+        if (register_count != 0) {
+            u32 start = pop ? REG(13) : REG(13) - register_count * 4;
+            u8* memory;
+
+            // Sync the whole transfer at once
+            SYNC_BURST(start, register_count, !pop);
+
+            // Fast path: copy straight between the register file and directly mapped RAM
+            memory = MEM_MAP(start & ~3, register_count * 4, !pop);
+
+            if (memory != NULL) {
+                for (int i = 0; i <= 7; i++) {
+                    if (instruction & (1 << i)) {
+                        if (pop) {
+                            u32 value;
+                            memcpy(&value, memory, sizeof(u32));
+                            REG(i) = value;
+                        } else {
+                            u32 value = REG(i);
+                            memcpy(memory, &value, sizeof(u32));
+                        }
+                        memory += 4;
+                    }
+                }
+
+                if (pop) {
+                    // Restore r15 if neccessary
+                    if (lr_pc) {
+                        u32 value;
+                        memcpy(&value, memory, sizeof(u32));
+                        state->r15 = value & ~1;
+                        cpu->pipeline.flush = true;
+                    }
+                    REG(13) = start + register_count * 4;
+                } else {
+                    // Store r14 if neccessary
+                    if (lr_pc) {
+                        u32 value = REG(14);
+                        memcpy(memory, &value, sizeof(u32));
+                    }
+                    REG(13) = start;
+                }
+                break;
+            }
+        }
+
+        if (pop) { // POP
             // Load specified registers
             for (int i = 0; i <= 7; i++) {
                 if (instruction & (1 << i)) {
@@ -591,8 +642,47 @@ void arm4_execute_thumb(arm_cpu* cpu, u16 instruction)
         int reg_base = (instruction >> 8) & 7;
         bool write_back = true;
         u32 address = REG(reg_base);
+        int register_count = __builtin_popcount(instruction & 0xFF);
         int first_register = 0;
 
+        if (register_count != 0) {
+            bool load = instruction & (1 << 11);
+            bool base_in_list = instruction & (1 << reg_base);
+            u8* memory;
+
+            // Sync the whole transfer at once
+            SYNC_BURST(address, register_count, !load);
+
+            // Fast path: copy straight between the register file and directly mapped RAM.
+            // STMIA with the base register not being the first register stores the
+            // partially updated base and thus is left to the generic code below.
+            if (load || !base_in_list || (instruction & ((1 << reg_base) - 1)) == 0) {
+                memory = MEM_MAP(address & ~3, register_count * 4, !load);
+
+                if (memory != NULL) {
+                    for (int i = 0; i <= 7; i++) {
+                        if (instruction & (1 << i)) {
+                            if (load) {
+                                u32 value;
+                                memcpy(&value, memory, sizeof(u32));
+                                REG(i) = value;
+                            } else {
+                                u32 value = REG(i);
+                                memcpy(memory, &value, sizeof(u32));
+                            }
+                            memory += 4;
+                        }
+                    }
+
+                    // Loading the base register disables writeback
+                    if (!load || !base_in_list) {
+                        REG(reg_base) = address + register_count * 4;
+                    }
+                    break;
+                }
+            }
+        }
+
         // Find the first register
         for (int i = 0; i < 8; i++) {
             if (instruction & (1 << i)) {
@@ -711,3 +801,162 @@ void arm4_execute_thumb(arm_cpu* cpu, u16 instruction)
     }
     }
 }
+
+// THUMB.1-THUMB.4 without updating the condition flags, used by the
+// cached interpreter when the flags are overwritten before being read.
+void arm4_execute_thumb_alu(arm_cpu* cpu, u16 instruction, thumb_instruction type)
+{
+    arm_state* state = cpu->state;
+    bool carry = state->cpsr & CPSR_CARRY;
+
+    // Sync prefetch from r15
+    SYNC(state->r15, SIZE_HWORD, false, CYCLE_S);
+
+    switch (type) {
+    case THUMB_1: {
+        int reg_dest = instruction & 7;
+        u32 value = REG((instruction >> 3) & 7);
+        u32 immediate_value = (instruction >> 6) & 0x1F;
+
+        switch ((instruction >> 11) & 3) {
+        case 0b00:
+            LSL(value, immediate_value, carry);
+            break;
+        case 0b01:
+            LSR(value, immediate_value, carry, true);
+            break;
+        case 0b10:
+            ASR(value, immediate_value, carry, true);
+            break;
+        }
+
+        REG(reg_dest) = value;
+        break;
+    }
+    case THUMB_2: {
+        int reg_dest = instruction & 7;
+        u32 operand;
+
+        if (instruction & (1 << 10)) {
+            operand = (instruction >> 6) & 7;
+        } else {
+            operand = REG((instruction >> 6) & 7);
+        }
+
+        if (instruction & (1 << 9)) {
+            REG(reg_dest) = REG((instruction >> 3) & 7) - operand;
+        } else {
+            REG(reg_dest) = REG((instruction >> 3) & 7) + operand;
+        }
+        break;
+    }
+    case THUMB_3: {
+        u32 immediate_value = instruction & 0xFF;
+        int reg_dest = (instruction >> 8) & 7;
+
+        switch ((instruction >> 11) & 3) {
+        case 0b00: // MOV
+            REG(reg_dest) = immediate_value;
+            break;
+        case 0b10: // ADD
+            REG(reg_dest) += immediate_value;
+            break;
+        case 0b11: // SUB
+            REG(reg_dest) -= immediate_value;
+            break;
+        }
+        break;
+    }
+    case THUMB_4: {
+        int reg_dest = instruction & 7;
+        int reg_source = (instruction >> 3) & 7;
+        u32 amount = REG(reg_source);
+
+        // TST, CMP and CMN only affect the flags
+        switch ((instruction >> 6) & 0xF) {
+        case 0b0000: // AND
+            REG(reg_dest) &= REG(reg_source);
+            break;
+        case 0b0001: // EOR
+            REG(reg_dest) ^= REG(reg_source);
+            break;
+        case 0b0010: // LSL
+            LSL(REG(reg_dest), amount, carry);
+            SYNC_ONE; // internal cycle
+            break;
+        case 0b0011: // LSR
+            LSR(REG(reg_dest), amount, carry, false);
+            SYNC_ONE; // internal cycle
+            break;
+        case 0b0100: // ASR
+            ASR(REG(reg_dest), amount, carry, false);
+            SYNC_ONE; // internal cycle
+            break;
+        case 0b0101: // ADC
+            REG(reg_dest) += REG(reg_source) + carry;
+            break;
+        case 0b0110: // SBC
+            REG(reg_dest) = REG(reg_dest) - REG(reg_source) + carry - 1;
+            break;
+        case 0b0111: // ROR
+            ROR(REG(reg_dest), amount, carry, false);
+            SYNC_ONE; // internal cycle
+            break;
+        case 0b1001: // NEG
+            REG(reg_dest) = 0 - REG(reg_source);
+            break;
+        case 0b1100: // ORR
+            REG(reg_dest) |= REG(reg_source);
+            break;
+        case 0b1101: // MUL
+            REG(reg_dest) *= REG(reg_source);
+            break;
+        case 0b1110: // BIC
+            REG(reg_dest) &= ~(REG(reg_source));
+            break;
+        case 0b1111: // MVN
+            REG(reg_dest) = ~(REG(reg_source));
+            break;
+        }
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+void arm4_execute_thumb_fused(arm_cpu* cpu, arm_op* op)
+{
+    arm_state* state = cpu->state;
+    u16 first = op[0].opcode;
+    u16 second = op[1].opcode;
+
+    // Executes op[0] and op[1] as one operation. Unless the pipeline gets
+    // flushed r15 is left as if op[1] had been executed on its own.
+    switch (op[0].fusion) {
+    case FUSE_BL: {
+        // THUMB.19 Branch with link, both halves at once.
+        // The second half sees r15 one halfword further.
+        u32 temp_pc = state->r15;
+        u32 value = state->r15 + ((first & 0x7FF) << 12) + ((second & 0x7FF) << 1);
+
+        value &= 0x7FFFFF;
+        state->r15 = ((state->r15 + SIZE_HWORD) & ~0x7FFFFF) | (value & ~1);
+
+        REG(14) = temp_pc | 1;
+        cpu->pipeline.flush = true;
+        break;
+    }
+    case FUSE_CMP_BRANCH:
+    case FUSE_LITERAL:
+        // Compare + conditional branch, PC-relative load + consumer
+        arm4_execute_thumb(cpu, first, op[0].type);
+        state->r15 += SIZE_HWORD;
+        if (op[1].flags & OP_SKIP_FLAGS) {
+            arm4_execute_thumb_alu(cpu, second, op[1].type);
+        } else {
+            arm4_execute_thumb(cpu, second, op[1].type);
+        }
+        break;
+    }
+}
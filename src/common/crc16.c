@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) 2016 Frederic Meyer
+ *
+ * This file is part of NoDS.
+ *
+ * NoDS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * NoDS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NoDS. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include "crc16.h"
+
+#define CRC16_POLY 0xA001
+
+// Slicing-by-8: table[n][byte] is the CRC of byte followed by n zeroes,
+// so eight bytes are folded with eight lookups instead of 64 shifts.
+static u16 crc16_table[8][256];
+
+__attribute__((constructor))
+static void crc16_init()
+{
+    for (int byte = 0; byte < 256; byte++) {
+        u16 crc = byte;
+
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (crc & 1 ? CRC16_POLY : 0);
+        }
+        crc16_table[0][byte] = crc;
+    }
+
+    for (int byte = 0; byte < 256; byte++) {
+        for (int n = 1; n < 8; n++) {
+            u16 crc = crc16_table[n - 1][byte];
+            crc16_table[n][byte] = (crc >> 8) ^ crc16_table[0][crc & 0xFF];
+        }
+    }
+}
+
+u16 crc16(u16 crc, const void* data, size_t size)
+{
+    const u8* bytes = data;
+
+    for (; size >= 8; size -= 8, bytes += 8) {
+        crc ^= bytes[0] | (bytes[1] << 8);
+        crc = crc16_table[7][crc & 0xFF] ^ crc16_table[6][crc >> 8] ^
+              crc16_table[5][bytes[2]] ^ crc16_table[4][bytes[3]] ^
+              crc16_table[3][bytes[4]] ^ crc16_table[2][bytes[5]] ^
+              crc16_table[1][bytes[6]] ^ crc16_table[0][bytes[7]];
+    }
+
+    while (size-- != 0) {
+        crc = (crc >> 8) ^ crc16_table[0][(crc ^ *bytes++) & 0xFF];
+    }
+
+    return crc;
+}
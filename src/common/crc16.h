@@ -0,0 +1,32 @@
+/*
+ * Copyright (C) 2016 Frederic Meyer
+ *
+ * This file is part of NoDS.
+ *
+ * NoDS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * NoDS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NoDS. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CRC16_H_
+#define _CRC16_H_
+
+#include <stddef.h>
+#include "types.h"
+
+// The reflected CRC-16 with polynomial 0xA001 which the DS uses for the
+// cartridge header and the BIOS GetCRC16 call. Headers start with 0xFFFF.
+#define CRC16_INIT 0xFFFF
+
+u16 crc16(u16 crc, const void* data, size_t size);
+
+#endif
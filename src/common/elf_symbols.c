@@ -0,0 +1,191 @@
+/*
+ * Copyright (C) 2016 Frederic Meyer
+ *
+ * This file is part of NoDS.
+ *
+ * NoDS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * NoDS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NoDS. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "log.h"
+#include "elf_symbols.h"
+
+#define ELF_SHT_SYMTAB 2
+#define ELF_STT_FUNC 2
+
+#pragma pack(push, 1)
+
+typedef struct {
+    u8 ident[16];
+    u16 type;
+    u16 machine;
+    u32 version;
+    u32 entry;
+    u32 phoff;
+    u32 shoff;
+    u32 flags;
+    u16 ehsize;
+    u16 phentsize;
+    u16 phnum;
+    u16 shentsize;
+    u16 shnum;
+    u16 shstrndx;
+} elf_header;
+
+typedef struct {
+    u32 name;
+    u32 type;
+    u32 flags;
+    u32 address;
+    u32 offset;
+    u32 size;
+    u32 link;
+    u32 info;
+    u32 addralign;
+    u32 entsize;
+} elf_section;
+
+typedef struct {
+    u32 name;
+    u32 value;
+    u32 size;
+    u8 info;
+    u8 other;
+    u16 shndx;
+} elf_sym;
+
+#pragma pack(pop)
+
+static int elf_symbol_compare(const void* a, const void* b)
+{
+    const elf_symbol* symbol_a = a;
+    const elf_symbol* symbol_b = b;
+
+    if (symbol_a->address != symbol_b->address) {
+        return symbol_a->address < symbol_b->address ? -1 : 1;
+    }
+    return 0;
+}
+
+static bool elf_read(FILE* file, u32 offset, void* buffer, u32 size)
+{
+    return fseek(file, offset, SEEK_SET) == 0 && fread(buffer, 1, size, file) == size;
+}
+
+elf_symbols* elf_load_symbols(char* path)
+{
+    FILE* file = fopen(path, "rb");
+    elf_header header;
+    elf_section symtab, strtab;
+    elf_sym* entries;
+    elf_symbols* symbols;
+    int count;
+    bool found = false;
+
+    if (file == NULL) {
+        LOG(LOG_HOST, LOG_ERROR, "fopen: %s", path);
+        return NULL;
+    }
+
+    // Only 32-bit little endian files are supported
+    if (!elf_read(file, 0, &header, sizeof(header)) || memcmp(header.ident, "\x7F" "ELF", 4) != 0 ||
+        header.ident[4] != 1 || header.ident[5] != 1 || header.shentsize != sizeof(elf_section)) {
+        LOG(LOG_HOST, LOG_ERROR, "ELF: %s is not a 32-bit little endian ELF file", path);
+        fclose(file);
+        return NULL;
+    }
+
+    // Find the symbol table and its string table
+    for (int i = 0; i < header.shnum && !found; i++) {
+        if (!elf_read(file, header.shoff + i * sizeof(elf_section), &symtab, sizeof(elf_section))) {
+            break;
+        }
+        found = symtab.type == ELF_SHT_SYMTAB;
+    }
+
+    if (!found || !elf_read(file, header.shoff + symtab.link * sizeof(elf_section), &strtab, sizeof(elf_section))) {
+        LOG(LOG_HOST, LOG_ERROR, "ELF: %s has no symbol table", path);
+        fclose(file);
+        return NULL;
+    }
+
+    count = symtab.size / sizeof(elf_sym);
+    entries = malloc(symtab.size);
+    symbols = calloc(1, sizeof(elf_symbols));
+    symbols->symbols = calloc(count, sizeof(elf_symbol));
+    symbols->strings = calloc(strtab.size + 1, 1);
+
+    if (!elf_read(file, symtab.offset, entries, count * sizeof(elf_sym)) ||
+        !elf_read(file, strtab.offset, symbols->strings, strtab.size)) {
+        LOG(LOG_HOST, LOG_ERROR, "ELF: %s is truncated", path);
+        free(entries);
+        elf_free_symbols(symbols);
+        fclose(file);
+        return NULL;
+    }
+
+    for (int i = 0; i < count; i++) {
+        if ((entries[i].info & 0xF) == ELF_STT_FUNC && entries[i].name < strtab.size) {
+            elf_symbol* symbol = &symbols->symbols[symbols->count++];
+
+            // Bit 0 only marks THUMB functions
+            symbol->address = entries[i].value & ~1;
+            symbol->size = entries[i].size;
+            symbol->name = &symbols->strings[entries[i].name];
+        }
+    }
+
+    qsort(symbols->symbols, symbols->count, sizeof(elf_symbol), elf_symbol_compare);
+
+    free(entries);
+    fclose(file);
+
+    LOG(LOG_HOST, LOG_INFO, "ELF: loaded %d function symbols from %s", symbols->count, path);
+    return symbols;
+}
+
+void elf_free_symbols(elf_symbols* symbols)
+{
+    free(symbols->symbols);
+    free(symbols->strings);
+    free(symbols);
+}
+
+// Finds the function containing address. Symbols without a size
+// are assumed to extend up to the next symbol.
+elf_symbol* elf_find_symbol(elf_symbols* symbols, u32 address)
+{
+    int low = 0;
+    int high = symbols->count - 1;
+    elf_symbol* symbol = NULL;
+
+    while (low <= high) {
+        int middle = (low + high) / 2;
+
+        if (symbols->symbols[middle].address <= address) {
+            symbol = &symbols->symbols[middle];
+            low = middle + 1;
+        } else {
+            high = middle - 1;
+        }
+    }
+
+    if (symbol != NULL && symbol->size != 0 && address >= symbol->address + symbol->size) {
+        return NULL;
+    }
+
+    return symbol;
+}
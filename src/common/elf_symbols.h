@@ -0,0 +1,44 @@
+/*
+ * Copyright (C) 2016 Frederic Meyer
+ *
+ * This file is part of NoDS.
+ *
+ * NoDS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * NoDS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NoDS. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _ELF_SYMBOLS_H_
+#define _ELF_SYMBOLS_H_
+
+#include "types.h"
+
+// Function symbols of an ELF32 (little endian) file, such
+// as the .elf files produced by the devkitPro ARM builds.
+
+typedef struct {
+    u32 address;
+    u32 size;
+    char* name;
+} elf_symbol;
+
+typedef struct {
+    elf_symbol* symbols; // sorted by address
+    int count;
+    char* strings;
+} elf_symbols;
+
+elf_symbols* elf_load_symbols(char* path);
+void elf_free_symbols(elf_symbols* symbols);
+elf_symbol* elf_find_symbol(elf_symbols* symbols, u32 address);
+
+#endif
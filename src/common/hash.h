@@ -0,0 +1,41 @@
+/*
+ * Copyright (C) 2016 Frederic Meyer
+ *
+ * This file is part of NoDS.
+ *
+ * NoDS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * NoDS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NoDS. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _HASH_H_
+#define _HASH_H_
+
+#include <stddef.h>
+#include "types.h"
+
+#define HASH_FNV_BASIS 0xCBF29CE484222325ULL
+#define HASH_FNV_PRIME 0x100000001B3ULL
+
+// 64-bit FNV-1a, pass HASH_FNV_BASIS or a previous hash to chain buffers
+static inline u64 hash_fnv1a(u64 hash, const void* data, size_t size)
+{
+    const u8* bytes = data;
+
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ bytes[i]) * HASH_FNV_PRIME;
+    }
+
+    return hash;
+}
+
+#endif
@@ -0,0 +1,380 @@
+/*
+ * Copyright (C) 2016 Frederic Meyer
+ *
+ * This file is part of NoDS.
+ *
+ * NoDS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * NoDS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NoDS. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include "log.h"
+
+#define LOG_RING_LENGTH 16384 // must be a power of two
+#define LOG_ARGUMENTS 8
+#define LOG_STRINGS 64
+#define LOG_MESSAGE_LENGTH 512
+
+typedef enum {
+    ARG_NONE,
+    ARG_INT,
+    ARG_LONG,
+    ARG_LONG_LONG,
+    ARG_SIZE,
+    ARG_DOUBLE,
+    ARG_POINTER,
+    ARG_STRING,
+    ARG_UNSUPPORTED
+} log_argument;
+
+typedef struct {
+    atomic_uint_fast64_t sequence;
+    u8 level;
+    int line;
+    const char* file;
+    const char* format; // NULL if arguments[0] points to a formatted message
+    u64 arguments[LOG_ARGUMENTS];
+    char strings[LOG_STRINGS]; // copies of the %s arguments
+} log_entry;
+
+atomic_uchar log_levels[LOG_CATEGORY_COUNT];
+
+// Bounded queue after Dmitry Vyukov: producers reserve a slot by advancing
+// head, the writer thread owns tail. A slot is ready to be read when its
+// sequence is one past its position and free when it equals the position.
+static log_entry ring[LOG_RING_LENGTH];
+static atomic_uint_fast64_t head;
+static atomic_uint_fast64_t tail;
+static atomic_uint_fast64_t dropped;
+static pthread_once_t started = PTHREAD_ONCE_INIT;
+static bool running = false;
+
+// The writer sleeps while the ring is empty. Producers only take the
+// lock to wake it, when they see it has gone to sleep.
+static pthread_mutex_t wake_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wake = PTHREAD_COND_INITIALIZER;
+static atomic_bool sleeping;
+
+static const char* level_names[] = {
+    "[" BLUE "INFO" RESET "]",
+    "[" MAGENTA "WARN" RESET "]",
+    "[" RED "ERROR" RESET "]"
+};
+
+// Parses the conversion after a '%' and returns the character behind it
+static const char* log_spec(const char* format, log_argument* argument)
+{
+    int length = 0;
+
+    while (*format != '\0' && strchr("-+ #0123456789.", *format)) {
+        format++;
+    }
+
+    while (*format != '\0' && strchr("hljztL", *format)) {
+        length = *format == 'l' && length == 'l' ? 'q' : *format;
+        format++;
+    }
+
+    switch (*format) {
+    case '%':
+        *argument = ARG_NONE;
+        break;
+    case 'd': case 'i': case 'u': case 'x': case 'X': case 'o': case 'c':
+        *argument = length == 'l' ? ARG_LONG :
+                    length == 'q' || length == 'j' ? ARG_LONG_LONG :
+                    length == 'z' || length == 't' ? ARG_SIZE : ARG_INT;
+        break;
+    case 'f': case 'F': case 'e': case 'E': case 'g': case 'G':
+        *argument = length == 'L' ? ARG_UNSUPPORTED : ARG_DOUBLE;
+        break;
+    case 'p':
+        *argument = ARG_POINTER;
+        break;
+    case 's':
+        *argument = length == 0 ? ARG_STRING : ARG_UNSUPPORTED;
+        break;
+    default:
+        // '*' widths, %n, wide strings and garbage
+        *argument = ARG_UNSUPPORTED;
+        return format;
+    }
+
+    return format + 1;
+}
+
+// Copies the arguments out of the va_list, false if the message does not fit
+static bool log_capture(log_entry* entry, const char* format, va_list list)
+{
+    int count = 0;
+    int strings = 0;
+
+    while ((format = strchr(format, '%')) != NULL) {
+        log_argument argument;
+        u64 value = 0;
+
+        format = log_spec(format + 1, &argument);
+        if (argument == ARG_NONE) {
+            continue;
+        }
+        if (argument == ARG_UNSUPPORTED || count == LOG_ARGUMENTS) {
+            return false;
+        }
+
+        switch (argument) {
+        case ARG_INT: value = (u64)va_arg(list, int); break;
+        case ARG_LONG: value = (u64)va_arg(list, long); break;
+        case ARG_LONG_LONG: value = (u64)va_arg(list, long long); break;
+        case ARG_SIZE: value = (u64)va_arg(list, size_t); break;
+        case ARG_POINTER: value = (u64)(uintptr_t)va_arg(list, void*); break;
+        case ARG_DOUBLE: {
+            double number = va_arg(list, double);
+            memcpy(&value, &number, sizeof(double));
+            break;
+        }
+        case ARG_STRING: {
+            const char* string = va_arg(list, const char*);
+            int length = strlen(string ? string : "(null)") + 1;
+
+            if (strings + length > LOG_STRINGS) {
+                return false;
+            }
+            memcpy(&entry->strings[strings], string ? string : "(null)", length);
+            value = strings;
+            strings += length;
+            break;
+        }
+        default:
+            break;
+        }
+
+        entry->arguments[count++] = value;
+    }
+
+    return true;
+}
+
+static void log_format(log_entry* entry, char* message, size_t size)
+{
+    const char* format = entry->format;
+    int count = 0;
+    size_t position = 0;
+
+    while (*format != '\0' && position < size - 1) {
+        const char* end;
+        char spec[32];
+        log_argument argument;
+        u64 value;
+        int written;
+
+        if (*format != '%') {
+            message[position++] = *format++;
+            continue;
+        }
+
+        end = log_spec(format + 1, &argument);
+        if (argument == ARG_NONE) {
+            message[position++] = '%';
+            format = end;
+            continue;
+        }
+
+        snprintf(spec, sizeof(spec), "%.*s", (int)(end - format), format);
+        value = entry->arguments[count++];
+
+        switch (argument) {
+        case ARG_LONG: written = snprintf(&message[position], size - position, spec, (long)value); break;
+        case ARG_LONG_LONG: written = snprintf(&message[position], size - position, spec, (long long)value); break;
+        case ARG_SIZE: written = snprintf(&message[position], size - position, spec, (size_t)value); break;
+        case ARG_POINTER: written = snprintf(&message[position], size - position, spec, (void*)(uintptr_t)value); break;
+        case ARG_STRING: written = snprintf(&message[position], size - position, spec, &entry->strings[value]); break;
+        case ARG_DOUBLE: {
+            double number;
+            memcpy(&number, &value, sizeof(double));
+            written = snprintf(&message[position], size - position, spec, number);
+            break;
+        }
+        default:
+            written = snprintf(&message[position], size - position, spec, (int)value);
+            break;
+        }
+
+        position += written > 0 ? written : 0;
+        format = end;
+    }
+
+    message[position < size ? position : size - 1] = '\0';
+}
+
+static void* log_writer(void* unused)
+{
+    u64 position = atomic_load(&tail);
+    u64 lost = 0;
+
+    while (true) {
+        log_entry* entry = &ring[position & (LOG_RING_LENGTH - 1)];
+        char message[LOG_MESSAGE_LENGTH];
+
+        if (atomic_load_explicit(&entry->sequence, memory_order_acquire) != position + 1) {
+            u64 now_lost = atomic_load(&dropped);
+
+            if (now_lost != lost) {
+                printf("%s log: dropped %llu messages\n", level_names[LOG_WARN], (unsigned long long)(now_lost - lost));
+                lost = now_lost;
+            }
+            fflush(stdout);
+
+            // Check again once sleeping is visible, a producer which
+            // published before that does not know it has to wake us
+            pthread_mutex_lock(&wake_lock);
+            atomic_store(&sleeping, true);
+            atomic_thread_fence(memory_order_seq_cst);
+            if (atomic_load_explicit(&entry->sequence, memory_order_acquire) != position + 1) {
+                pthread_cond_wait(&wake, &wake_lock);
+            }
+            atomic_store(&sleeping, false);
+            pthread_mutex_unlock(&wake_lock);
+            continue;
+        }
+
+        if (entry->format == NULL) {
+            printf("%s %s:%d: %s\n", level_names[entry->level], entry->file, entry->line, (char*)(uintptr_t)entry->arguments[0]);
+            free((char*)(uintptr_t)entry->arguments[0]);
+        } else {
+            log_format(entry, message, sizeof(message));
+            printf("%s %s:%d: %s\n", level_names[entry->level], entry->file, entry->line, message);
+        }
+
+        atomic_store_explicit(&entry->sequence, position + LOG_RING_LENGTH, memory_order_release);
+        atomic_store(&tail, ++position);
+    }
+
+    return NULL;
+}
+
+static void log_start()
+{
+    pthread_t thread;
+
+    for (int i = 0; i < LOG_RING_LENGTH; i++) {
+        atomic_init(&ring[i].sequence, i);
+    }
+
+    if (pthread_create(&thread, NULL, log_writer, NULL) == 0) {
+        pthread_detach(thread);
+        atexit(log_flush);
+        running = true;
+    }
+}
+
+void log_push(int category, int level, const char* file, int line, const char* format, ...)
+{
+    u64 position;
+    log_entry* entry;
+    va_list list;
+
+    pthread_once(&started, log_start);
+
+    // Without a writer thread messages are printed right away
+    if (!running) {
+        printf("%s %s:%d: ", level_names[level], file, line);
+        va_start(list, format);
+        vprintf(format, list);
+        va_end(list);
+        putchar('\n');
+        return;
+    }
+
+    // Reserve a slot, or drop the message if the writer is behind
+    position = atomic_load_explicit(&head, memory_order_relaxed);
+    while (true) {
+        u64 sequence;
+
+        entry = &ring[position & (LOG_RING_LENGTH - 1)];
+        sequence = atomic_load_explicit(&entry->sequence, memory_order_acquire);
+
+        if (sequence == position) {
+            if (atomic_compare_exchange_weak(&head, &position, position + 1)) {
+                break;
+            }
+        } else if (sequence < position) {
+            atomic_fetch_add(&dropped, 1);
+            return;
+        } else {
+            position = atomic_load_explicit(&head, memory_order_relaxed);
+        }
+    }
+
+    entry->level = level;
+    entry->file = file;
+    entry->line = line;
+    entry->format = format;
+
+    va_start(list, format);
+    if (!log_capture(entry, format, list)) {
+        va_list again;
+        char* message = malloc(LOG_MESSAGE_LENGTH);
+
+        // Exotic or oversized messages are formatted right away, with
+        // the same length limit as the writer. Without memory they are
+        // cut to what fits into the entry.
+        va_end(list);
+        va_start(again, format);
+        if (message != NULL) {
+            vsnprintf(message, LOG_MESSAGE_LENGTH, format, again);
+            entry->format = NULL;
+            entry->arguments[0] = (u64)(uintptr_t)message;
+        } else {
+            vsnprintf(entry->strings, LOG_STRINGS, format, again);
+            entry->format = "%s";
+            entry->arguments[0] = 0;
+        }
+        va_end(again);
+    } else {
+        va_end(list);
+    }
+
+    atomic_store_explicit(&entry->sequence, position + 1, memory_order_release);
+
+    // Pairs with the fence of the writer, one of both sees the other
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&sleeping, memory_order_relaxed)) {
+        pthread_mutex_lock(&wake_lock);
+        pthread_cond_signal(&wake);
+        pthread_mutex_unlock(&wake_lock);
+    }
+}
+
+void log_set_level(int category, int level)
+{
+    atomic_store_explicit(&log_levels[category], level, memory_order_relaxed);
+}
+
+// Waits until the writer has printed everything queued so far
+void log_flush()
+{
+    struct timespec idle = { 0, 1000000 };
+    u64 target = atomic_load(&head);
+
+    if (!running) {
+        return;
+    }
+    while (atomic_load(&tail) < target) {
+        nanosleep(&idle, NULL);
+    }
+    fflush(stdout);
+}
@@ -21,35 +21,61 @@
 #define _LOG_H_
 
 #include <stdio.h>
+#include <stdatomic.h>
+#include "types.h"
 
 #define LOG_INFO 0
 #define LOG_WARN 1
 #define LOG_ERROR 2
+#define LOG_NONE 3
+
+// Categories, one bit each in LOG_CATEGORIES
+#define LOG_CPU 0
+#define LOG_MMU 1
+#define LOG_IPC 2
+#define LOG_SPI 3
+#define LOG_FIRM 4
+#define LOG_CART 5
+#define LOG_HOST 6 // frontend, debugger and tools
+#define LOG_CATEGORY_COUNT 7
 
 #define RED     "\x1b[31m"
 #define BLUE    "\x1b[34m"
 #define MAGENTA "\x1b[35m"
 #define RESET   "\x1b[0m"
 
+// Messages below LOG_LEVEL or outside of LOG_CATEGORIES are not compiled
+// in at all, e.g. make CFLAGS+="-DLOG_LEVEL=LOG_WARN -DLOG_CATEGORIES=0x3"
+#ifndef LOG_LEVEL
 #ifdef DEBUG
-#define LOG(loglevel, ...) { int _line = __LINE__;\
-    char message[512];\
-    snprintf(message, 512, __VA_ARGS__);\
-    switch (loglevel)\
-    {\
-    case LOG_INFO: printf("[" BLUE "INFO" RESET "] %s:%d: %s\n", __FILE__, _line, message); break;\
-    case LOG_WARN: printf("[" MAGENTA "WARN" RESET "] %s:%d: %s\n", __FILE__, _line, message); break;\
-    case LOG_ERROR: printf("[" RED "ERROR" RESET "] %s:%d: %s\n", __FILE__, _line, message); break;\
-    }\
-}
+#define LOG_LEVEL LOG_INFO
 #else
-#define LOG(loglevel, ...) {}
+#define LOG_LEVEL LOG_WARN
+#endif
 #endif
 
-#ifdef DEBUG
-#define ASSERT(condition, loglevel, ...) { if (condition) LOG(loglevel, __VA_ARGS__) }
-#else
-#define ASSERT(condition, loglevel, ...) {}
+#ifndef LOG_CATEGORIES
+#define LOG_CATEGORIES ((1 << LOG_CATEGORY_COUNT) - 1)
 #endif
 
+// Minimum level per category at runtime, see log_set_level. Atomic so
+// levels can change while other threads log, a relaxed load is a plain one.
+extern atomic_uchar log_levels[LOG_CATEGORY_COUNT];
+
+// Messages are queued with their raw arguments and formatted by a
+// background thread, so an enabled LOG() does not wait for stdout
+// and a disabled one costs a single compare.
+#define LOG(category, loglevel, ...) {\
+    if (((LOG_CATEGORIES >> (category)) & 1) && (loglevel) >= LOG_LEVEL && (loglevel) >= atomic_load_explicit(&log_levels[category], memory_order_relaxed)) {\
+        log_push(category, loglevel, __FILE__, __LINE__, __VA_ARGS__);\
+    }\
+}
+
+#define ASSERT(condition, category, loglevel, ...) { if (condition) LOG(category, loglevel, __VA_ARGS__) }
+
+void log_push(int category, int level, const char* file, int line, const char* format, ...)
+    __attribute__((format(printf, 5, 6)));
+void log_set_level(int category, int level);
+void log_flush();
+
 #endif
@@ -0,0 +1,182 @@
+/*
+ * Copyright (C) 2016 Frederic Meyer
+ *
+ * This file is part of NoDS.
+ *
+ * NoDS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * NoDS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NoDS. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include "lz.h"
+
+static inline u32 lz_hash(const u8* pointer)
+{
+    u32 value;
+
+    memcpy(&value, pointer, 4);
+    return (value * 2654435761U) >> (32 - LZ_HASH_BITS);
+}
+
+// Lengths of 15 and more continue in bytes of 255 and a remainder
+static inline u8* lz_write_length(u8* out, u32 length)
+{
+    for (; length >= 255; length -= 255) {
+        *out++ = 255;
+    }
+    *out++ = length;
+    return out;
+}
+
+static inline u8* lz_write_sequence(u8* out, const u8* literals, u32 literal_length, u32 match_length)
+{
+    u8* token = out++;
+
+    *token = (literal_length < 15 ? literal_length : 15) << 4;
+    if (literal_length >= 15) {
+        out = lz_write_length(out, literal_length - 15);
+    }
+    memcpy(out, literals, literal_length);
+    out += literal_length;
+
+    if (match_length != 0) {
+        match_length -= LZ_MIN_MATCH;
+        *token |= match_length < 15 ? match_length : 15;
+    }
+
+    return out;
+}
+
+// Returns the compressed size, 0 if it does not fit into capacity
+u32 lz_compress(const u8* source, u32 size, u8* dest, u32 capacity)
+{
+    u32 table[1 << LZ_HASH_BITS];
+    const u8* end = source + size;
+    const u8* limit = size > LZ_MIN_MATCH ? end - LZ_MIN_MATCH : source;
+    const u8* in = source;
+    const u8* anchor = source;
+    u8* out = dest;
+
+    if (capacity < LZ_BOUND(size)) {
+        return 0;
+    }
+
+    memset(table, 0xFF, sizeof(table));
+
+    while (in < limit) {
+        u32 hash = lz_hash(in);
+        u32 candidate = table[hash];
+        const u8* match = source + candidate;
+        u32 match_length = 0;
+
+        table[hash] = in - source;
+
+        if (candidate == 0xFFFFFFFF || in - match > 0xFFFF || memcmp(in, match, LZ_MIN_MATCH) != 0) {
+            in++;
+            continue;
+        }
+
+        match_length = LZ_MIN_MATCH;
+        while (in + match_length < end && in[match_length] == match[match_length]) {
+            match_length++;
+        }
+
+        out = lz_write_sequence(out, anchor, in - anchor, match_length);
+        *out++ = (in - match) & 0xFF;
+        *out++ = (in - match) >> 8;
+        if (match_length - LZ_MIN_MATCH >= 15) {
+            out = lz_write_length(out, match_length - LZ_MIN_MATCH - 15);
+        }
+
+        in += match_length;
+        anchor = in;
+    }
+
+    // The stream ends with the remaining literals and no match
+    out = lz_write_sequence(out, anchor, end - anchor, 0);
+
+    return out - dest;
+}
+
+static inline bool lz_read_length(const u8** in, const u8* end, u32* length)
+{
+    u8 value;
+
+    do {
+        if (*in >= end) {
+            return false;
+        }
+        value = *(*in)++;
+        *length += value;
+    } while (value == 255);
+
+    return true;
+}
+
+// Fails on corrupt data instead of writing outside of dest
+bool lz_decompress(const u8* source, u32 size, u8* dest, u32 dest_size)
+{
+    const u8* in = source;
+    const u8* end = source + size;
+    u8* out = dest;
+    u8* out_end = dest + dest_size;
+
+    while (in < end) {
+        u8 token = *in++;
+        u32 literal_length = token >> 4;
+        u32 match_length = token & 15;
+        u32 offset;
+
+        if (literal_length == 15 && !lz_read_length(&in, end, &literal_length)) {
+            return false;
+        }
+        if (literal_length > (u32)(end - in) || literal_length > (u32)(out_end - out)) {
+            return false;
+        }
+        memcpy(out, in, literal_length);
+        in += literal_length;
+        out += literal_length;
+
+        // Only the last sequence has no match
+        if (in == end) {
+            break;
+        }
+
+        if (end - in < 2) {
+            return false;
+        }
+        offset = in[0] | (in[1] << 8);
+        in += 2;
+
+        if (match_length == 15 && !lz_read_length(&in, end, &match_length)) {
+            return false;
+        }
+        match_length += LZ_MIN_MATCH;
+
+        if (offset == 0 || offset > (u32)(out - dest) || match_length > (u32)(out_end - out)) {
+            return false;
+        }
+
+        // Matches may overlap what they produce
+        if (offset >= match_length) {
+            memcpy(out, out - offset, match_length);
+            out += match_length;
+        } else {
+            for (u32 i = 0; i < match_length; i++, out++) {
+                *out = out[-(int)offset];
+            }
+        }
+    }
+
+    return out == out_end;
+}
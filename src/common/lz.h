@@ -0,0 +1,38 @@
+/*
+ * Copyright (C) 2016 Frederic Meyer
+ *
+ * This file is part of NoDS.
+ *
+ * NoDS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * NoDS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NoDS. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _LZ_H_
+#define _LZ_H_
+
+#include "types.h"
+
+// Byte-oriented LZ77 in the spirit of LZ4: each sequence is a token,
+// a run of literals and a match of at least LZ_MIN_MATCH bytes up to
+// 64KB back. Decoding is a few copies per sequence and needs no state.
+
+#define LZ_MIN_MATCH 4
+#define LZ_HASH_BITS 12
+
+// Worst case size of the compressed data, when nothing matches
+#define LZ_BOUND(size) ((size) + (size) / 255 + 16)
+
+u32 lz_compress(const u8* source, u32 size, u8* dest, u32 capacity);
+bool lz_decompress(const u8* source, u32 size, u8* dest, u32 dest_size);
+
+#endif
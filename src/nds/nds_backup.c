@@ -0,0 +1,276 @@
+/*
+ * Copyright (C) 2016 Frederic Meyer
+ *
+ * This file is part of NoDS.
+ *
+ * NoDS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * NoDS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NoDS. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "common/log.h"
+#include "nds_backup.h"
+
+static void* nds_backup_flusher(void* object)
+{
+    nds_backup* backup = object;
+
+    pthread_mutex_lock(&backup->lock);
+    while (backup->running) {
+        struct timespec deadline;
+
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += BACKUP_FLUSH_INTERVAL;
+        pthread_cond_timedwait(&backup->stop, &backup->lock, &deadline);
+
+        // Also runs once more after nds_backup_close woke us up
+        if (atomic_exchange(&backup->dirty, false)) {
+            msync(backup->data, backup->size, MS_SYNC);
+        }
+    }
+    pthread_mutex_unlock(&backup->lock);
+
+    return NULL;
+}
+
+// The size of an existing save file wins over size, which
+// is only used to create new ones (0 for the default).
+nds_backup* nds_backup_open(char* path, u32 size)
+{
+    nds_backup* backup;
+    struct stat status;
+    void* data;
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+
+    if (fd == -1 || fstat(fd, &status) != 0) {
+        LOG(LOG_CART, LOG_ERROR, "BACKUP: cannot open %s", path);
+        if (fd != -1) {
+            close(fd);
+        }
+        return NULL;
+    }
+
+    if (status.st_size != 0) {
+        size = status.st_size;
+    } else if (size == 0) {
+        size = BACKUP_DEFAULT_SIZE;
+    }
+
+    if ((status.st_size == 0 && ftruncate(fd, size) != 0) ||
+        (data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+        LOG(LOG_CART, LOG_ERROR, "BACKUP: cannot map %s", path);
+        close(fd);
+        return NULL;
+    }
+    close(fd);
+
+    backup = calloc(1, sizeof(nds_backup));
+    backup->data = data;
+    backup->size = size;
+
+    // New chips come erased
+    if (status.st_size == 0) {
+        memset(data, 0xFF, size);
+        atomic_store(&backup->dirty, true);
+    }
+
+    if (size <= 0x200) {
+        backup->type = BACKUP_EEPROM_TINY;
+        backup->address_bytes = 1;
+    } else if (size <= 0x10000) {
+        backup->type = BACKUP_EEPROM;
+        backup->address_bytes = 2;
+    } else {
+        backup->type = BACKUP_FLASH;
+        backup->address_bytes = 3;
+    }
+
+    pthread_mutex_init(&backup->lock, NULL);
+    pthread_cond_init(&backup->stop, NULL);
+    backup->running = pthread_create(&backup->flusher, NULL, nds_backup_flusher, backup) == 0;
+
+    LOG(LOG_CART, LOG_INFO, "BACKUP: mapped 0x%x bytes from %s", size, path);
+    return backup;
+}
+
+// A private copy that is never written back, e.g. for forked machines
+nds_backup* nds_backup_copy(nds_backup* backup)
+{
+    nds_backup* copy;
+    void* data = mmap(NULL, backup->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (data == MAP_FAILED) {
+        LOG(LOG_CART, LOG_ERROR, "BACKUP: cannot map a copy of 0x%x bytes", backup->size);
+        return NULL;
+    }
+    memcpy(data, backup->data, backup->size);
+
+    copy = calloc(1, sizeof(nds_backup));
+    copy->data = data;
+    copy->size = backup->size;
+    copy->type = backup->type;
+    copy->address_bytes = backup->address_bytes;
+    copy->command = backup->command;
+    copy->transfers = backup->transfers;
+    copy->address = backup->address;
+    copy->writable = backup->writable;
+
+    // No flusher, nds_backup_close only unmaps it
+    pthread_mutex_init(&copy->lock, NULL);
+    pthread_cond_init(&copy->stop, NULL);
+
+    return copy;
+}
+
+void nds_backup_close(nds_backup* backup)
+{
+    if (backup->running) {
+        pthread_mutex_lock(&backup->lock);
+        backup->running = false;
+        pthread_cond_signal(&backup->stop);
+        pthread_mutex_unlock(&backup->lock);
+        pthread_join(backup->flusher, NULL);
+    } else {
+        msync(backup->data, backup->size, MS_SYNC);
+    }
+
+    munmap(backup->data, backup->size);
+    pthread_mutex_destroy(&backup->lock);
+    pthread_cond_destroy(&backup->stop);
+    free(backup);
+}
+
+static void nds_backup_erase(nds_backup* backup, u32 size)
+{
+    u32 address = backup->address & ~(size - 1);
+
+    if (address < backup->size) {
+        memset(&backup->data[address], 0xFF, size < backup->size - address ? size : backup->size - address);
+        atomic_store_explicit(&backup->dirty, true, memory_order_release);
+    }
+}
+
+// Shifts value into the chip and returns the byte shifted out
+u8 nds_backup_transfer(nds_backup* backup, u8 value)
+{
+    int transfers = backup->transfers++;
+    int command = backup->command;
+    bool flash = backup->type == BACKUP_FLASH;
+    u8 output;
+
+    if (transfers == 0) {
+        backup->command = value;
+
+        // The tiny EEPROM takes the ninth address bit from the command
+        backup->address = backup->type == BACKUP_EEPROM_TINY && (value & 8) ? 1 : 0;
+
+        switch (value) {
+        case BACKUP_CMD_WREN:
+            backup->writable = true;
+            break;
+        case BACKUP_CMD_WRDI:
+            backup->writable = false;
+            break;
+        }
+        return 0xFF;
+    }
+
+    switch (command) {
+    case BACKUP_CMD_RDSR:
+        return backup->writable ? 2 : 0;
+    case BACKUP_CMD_RDID:
+        if (!flash || transfers > 3) {
+            return 0xFF;
+        }
+        // ST M45PExx: manufacturer, memory type, capacity
+        return transfers == 1 ? 0x20 : transfers == 2 ? 0x40 : 0x12 + (backup->size > 0x40000) + (backup->size > 0x80000);
+    case BACKUP_CMD_READ:
+    case BACKUP_CMD_READ_HI:
+    case BACKUP_CMD_WRITE:
+    case BACKUP_CMD_WRITE_HI:
+    case BACKUP_CMD_PE:
+    case BACKUP_CMD_SE:
+        break;
+    default:
+        return 0xFF;
+    }
+
+    if (transfers <= backup->address_bytes) {
+        backup->address = ((backup->address << 8) | value) % backup->size;
+
+        // Erases complete with the address
+        if (transfers == backup->address_bytes && flash && backup->writable) {
+            if (command == BACKUP_CMD_PE) {
+                nds_backup_erase(backup, 0x100);
+            } else if (command == BACKUP_CMD_SE) {
+                nds_backup_erase(backup, 0x10000);
+            }
+        }
+        return 0xFF;
+    }
+
+    switch (command) {
+    case BACKUP_CMD_READ_HI:
+        // FAST READ sends a dummy byte first
+        if (flash && transfers == backup->address_bytes + 1) {
+            return 0xFF;
+        }
+        // fall through
+    case BACKUP_CMD_READ:
+        output = backup->data[backup->address];
+        backup->address = (backup->address + 1) % backup->size;
+        return output;
+    case BACKUP_CMD_WRITE:
+    case BACKUP_CMD_WRITE_HI:
+        if (!backup->writable) {
+            return 0xFF;
+        }
+
+        // Page program on FLASH can only clear bits
+        if (flash && command == BACKUP_CMD_WRITE) {
+            backup->data[backup->address] &= value;
+        } else {
+            backup->data[backup->address] = value;
+        }
+        backup->address = (backup->address + 1) % backup->size;
+        atomic_store_explicit(&backup->dirty, true, memory_order_release);
+        return 0xFF;
+    }
+
+    return 0xFF;
+}
+
+// Chip select went high, the next byte starts a new command
+void nds_backup_release(nds_backup* backup)
+{
+    // Write enable is reset once a write or erase completes
+    switch (backup->command) {
+    case BACKUP_CMD_WRITE:
+    case BACKUP_CMD_WRITE_HI:
+    case BACKUP_CMD_PE:
+    case BACKUP_CMD_SE:
+        if (backup->transfers > backup->address_bytes) {
+            backup->writable = false;
+        }
+        break;
+    }
+
+    backup->command = 0;
+    backup->transfers = 0;
+}
@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) 2016 Frederic Meyer
+ *
+ * This file is part of NoDS.
+ *
+ * NoDS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * NoDS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NoDS. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _NDS_BACKUP_H_
+#define _NDS_BACKUP_H_
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include "common/types.h"
+
+// Cartridge save memory behind the AUXSPI bus. The contents live in a
+// shared mapping of the save file, a background thread msyncs it once
+// a second after writes and at close, so writes never wait for disk.
+
+#define BACKUP_FLUSH_INTERVAL 1 // seconds
+#define BACKUP_DEFAULT_SIZE 0x10000
+
+typedef enum {
+    BACKUP_EEPROM_TINY = 0, // 512 bytes, ninth address bit in the command
+    BACKUP_EEPROM = 1, // EEPROM or FRAM up to 64KB, 16-bit addresses
+    BACKUP_FLASH = 2 // 256KB and up, 24-bit addresses
+} nds_backup_type;
+
+typedef enum {
+    BACKUP_CMD_WRSR = 0x01,
+    BACKUP_CMD_WRITE = 0x02, // page program on FLASH
+    BACKUP_CMD_READ = 0x03,
+    BACKUP_CMD_WRDI = 0x04,
+    BACKUP_CMD_RDSR = 0x05,
+    BACKUP_CMD_WREN = 0x06,
+    BACKUP_CMD_WRITE_HI = 0x0A, // page write on FLASH
+    BACKUP_CMD_READ_HI = 0x0B, // fast read on FLASH
+    BACKUP_CMD_RDID = 0x9F,
+    BACKUP_CMD_SE = 0xD8,
+    BACKUP_CMD_PE = 0xDB
+} nds_backup_cmd;
+
+typedef struct {
+    u8* data;
+    u32 size;
+    nds_backup_type type;
+    int address_bytes;
+
+    // Transfer state, reset whenever chip select is released
+    int command;
+    int transfers;
+    u32 address;
+    bool writable;
+
+    // Set by writes, cleared by the flush thread
+    atomic_bool dirty;
+    bool running;
+    pthread_t flusher;
+    pthread_mutex_t lock;
+    pthread_cond_t stop;
+} nds_backup;
+
+nds_backup* nds_backup_open(char* path, u32 size);
+nds_backup* nds_backup_copy(nds_backup* backup);
+void nds_backup_close(nds_backup* backup);
+u8 nds_backup_transfer(nds_backup* backup, u8 value);
+void nds_backup_release(nds_backup* backup);
+
+#endif
@@ -0,0 +1,107 @@
+/*
+ * Copyright (C) 2016 Frederic Meyer
+ *
+ * This file is part of NoDS.
+ *
+ * NoDS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * NoDS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NoDS. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "nds_cartbus.h"
+#include "common/log.h"
+
+// Block size field of ROMCTRL, 0 transfers nothing and 7 a single word
+static u32 nds_cart_bus_length(u32 romctrl)
+{
+    int size = (romctrl & ROMCTRL_BLOCK_SIZE) >> 24;
+
+    if (size == 0) {
+        return 0;
+    }
+    if (size == 7) {
+        return 4;
+    }
+    return 0x100 << size;
+}
+
+void nds_cart_bus_start(nds_cart_bus* cart_bus)
+{
+    u8* command = cart_bus->command;
+
+    cart_bus->kind = command[0];
+    cart_bus->position = 0;
+    cart_bus->length = nds_cart_bus_length(cart_bus->romctrl);
+
+    switch (command[0]) {
+    case CART_CMD_READ:
+        cart_bus->address = (command[1] << 24) | (command[2] << 16) | (command[3] << 8) | command[4];
+
+        // The secure area cannot be read this way, the chip redirects
+        if (cart_bus->address < 0x8000) {
+            cart_bus->address = 0x8000 + (cart_bus->address & 0x1FF);
+        }
+        LOG(LOG_CART, LOG_INFO, "CART: read 0x%x bytes at 0x%x", cart_bus->length, cart_bus->address);
+
+        // Games stream their data, so the following pages are next
+        nds_cart_readahead(cart_bus->cart, cart_bus->address + cart_bus->length);
+        break;
+    case CART_CMD_HEADER:
+        cart_bus->address = 0;
+        break;
+    case CART_CMD_CHIP_ID:
+    case CART_CMD_CHIP_ID_RAW:
+    case CART_CMD_DUMMY:
+        break;
+    default:
+        LOG(LOG_CART, LOG_WARN, "CART: unsupported command 0x%x", command[0]);
+        break;
+    }
+
+    if (cart_bus->length == 0) {
+        cart_bus->romctrl &= ~(ROMCTRL_START | ROMCTRL_DATA_READY);
+    } else {
+        cart_bus->romctrl |= ROMCTRL_START | ROMCTRL_DATA_READY;
+    }
+}
+
+// Clocks out the next word, the start bit clears with the last one
+u32 nds_cart_bus_read(nds_cart_bus* cart_bus)
+{
+    u32 value = 0xFFFFFFFF;
+    u32 address;
+
+    if (!(cart_bus->romctrl & ROMCTRL_DATA_READY)) {
+        LOG(LOG_CART, LOG_WARN, "CART: data read without a transfer");
+        return value;
+    }
+
+    switch (cart_bus->kind) {
+    case CART_CMD_READ:
+    case CART_CMD_HEADER:
+        // Reads wrap around within 4KB
+        address = (cart_bus->address & ~0xFFF) | ((cart_bus->address + cart_bus->position) & 0xFFF);
+        nds_cart_read(cart_bus->cart, address, &value, 4);
+        break;
+    case CART_CMD_CHIP_ID:
+    case CART_CMD_CHIP_ID_RAW:
+        value = NDS_CHIP_ID;
+        break;
+    }
+
+    cart_bus->position += 4;
+    if (cart_bus->position >= cart_bus->length) {
+        cart_bus->romctrl &= ~(ROMCTRL_START | ROMCTRL_DATA_READY);
+    }
+
+    return value;
+}
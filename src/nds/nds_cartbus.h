@@ -0,0 +1,60 @@
+/*
+ * Copyright (C) 2016 Frederic Meyer
+ *
+ * This file is part of NoDS.
+ *
+ * NoDS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * NoDS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NoDS. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _NDS_CARTBUS_H_
+#define _NDS_CARTBUS_H_
+
+#include "common/types.h"
+#include "nds_cartridge.h"
+
+// Slot-1 ROM transfers. A command is written to the eight command
+// bytes, setting the start bit in ROMCTRL begins the transfer and the
+// data is then read word by word from the data port.
+
+typedef enum {
+    CART_CMD_HEADER = 0x00,
+    CART_CMD_CHIP_ID_RAW = 0x90,
+    CART_CMD_DUMMY = 0x9F,
+    CART_CMD_READ = 0xB7,
+    CART_CMD_CHIP_ID = 0xB8
+} nds_cart_cmd;
+
+typedef enum {
+    ROMCTRL_DATA_READY = 1 << 23,
+    ROMCTRL_BLOCK_SIZE = 7 << 24,
+    ROMCTRL_START = 1 << 31
+} nds_romctrl;
+
+typedef struct {
+    u32 romctrl;
+    u8 command[8];
+
+    // Current transfer
+    int kind; // command byte the transfer was started with
+    u32 address;
+    u32 length;
+    u32 position;
+
+    nds_cartridge* cart;
+} nds_cart_bus;
+
+void nds_cart_bus_start(nds_cart_bus* cart_bus);
+u32 nds_cart_bus_read(nds_cart_bus* cart_bus);
+
+#endif
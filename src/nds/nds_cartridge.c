@@ -17,42 +17,407 @@
  * along with NoDS. If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stddef.h>
 #include "common/log.h"
+#include "common/crc16.h"
+#include "common/hash.h"
 #include "nds_cartridge.h"
+#include "nds_key1.h"
+
+typedef struct {
+    char magic[4];
+    char game_code[4];
+    u16 header_checksum;
+    u16 reserved;
+} nds_secure_file;
 
 void nds_cart_get_type(nds_cartridge* cart)
 {
-    // We assume for now that ROM is not encrypted.
+    const u32* secure = (const u32*)nds_cart_slice(cart, CART_SECURE_AREA, 8);
+
+    // Only an ARM9 binary starting inside of the secure area has one
+    if (cart->header->arm9.rom < CART_SECURE_AREA || cart->header->arm9.rom >= 0x8000 || secure == NULL) {
+        cart->type = CART_HOMEBREW;
+    } else if (secure[0] == CART_SECURE_ID && secure[1] == CART_SECURE_ID) {
+        cart->type = CART_DUMPED;
+    } else {
+        cart->type = CART_ENCRYPTED;
+    }
+}
+
+// Checks the CRCs the BIOS checks. The secure area CRC is over the
+// encrypted data, so it can only be checked for encrypted dumps.
+static bool nds_cart_verify(nds_cartridge* cart)
+{
+    const nds_header* header = cart->header;
+    u8* secure;
+    u16 crc;
+
+    crc = crc16(CRC16_INIT, header, offsetof(nds_header, header_checksum));
+    if (crc != header->header_checksum) {
+        LOG(LOG_CART, LOG_ERROR, "header CRC is 0x%x, expected 0x%x", crc, header->header_checksum);
+        return false;
+    }
+
+    // Covered by the header CRC, so only a warning
+    crc = crc16(CRC16_INIT, header->logo, sizeof(header->logo));
+    if (crc != header->logo_checksum) {
+        LOG(LOG_CART, LOG_WARN, "logo CRC is 0x%x, expected 0x%x", crc, header->logo_checksum);
+    }
+
+    if (cart->type == CART_ENCRYPTED) {
+        secure = malloc(0x4000);
+        nds_cart_read(cart, CART_SECURE_AREA, secure, 0x4000);
+        crc = crc16(CRC16_INIT, secure, 0x4000);
+        free(secure);
+
+        if (crc != header->secure_checksum) {
+            LOG(LOG_CART, LOG_ERROR, "secure area CRC is 0x%x, expected 0x%x", crc, header->secure_checksum);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Decrypts the secure area like the BIOS does when booting the cartridge
+static bool nds_cart_decrypt_secure(nds_cartridge* cart, char* bios_path, u32* secure)
+{
+    FILE* file = fopen(bios_path, "rb");
+    u32* key_buffer = malloc(KEY1_TABLE_SIZE * sizeof(u32));
+    u32 id_code = *(const u32*)cart->header->game_code;
+    nds_key1 key1;
+
+    if (file == NULL || fseek(file, KEY1_BIOS_OFFSET, SEEK_SET) != 0 ||
+        fread(key_buffer, sizeof(u32), KEY1_TABLE_SIZE, file) != KEY1_TABLE_SIZE) {
+        LOG(LOG_CART, LOG_ERROR, "KEY1: cannot read the key buffer from %s", bios_path);
+        if (file != NULL) {
+            fclose(file);
+        }
+        free(key_buffer);
+        return false;
+    }
+    fclose(file);
+
+    nds_key1_init(&key1, key_buffer, id_code, 2, 8);
+    nds_key1_decrypt(&key1, secure);
+    nds_key1_init(&key1, key_buffer, id_code, 3, 8);
+    for (int i = 0; i < CART_SECURE_SIZE / 4; i += 2) {
+        nds_key1_decrypt(&key1, &secure[i]);
+    }
+    free(key_buffer);
+
+    if (memcmp(secure, "encryObj", 8) != 0) {
+        LOG(LOG_CART, LOG_ERROR, "KEY1: secure area does not decrypt, wrong BIOS?");
+        return false;
+    }
+    secure[0] = CART_SECURE_ID;
+    secure[1] = CART_SECURE_ID;
+
+    return true;
+}
+
+static bool nds_cart_load_secure(nds_cartridge* cart, char* path, u32* secure)
+{
+    FILE* file = fopen(path, "rb");
+    nds_secure_file header;
+    bool valid;
+
+    if (file == NULL) {
+        return false;
+    }
+
+    valid = fread(&header, sizeof(header), 1, file) == 1 && memcmp(header.magic, "NDSK", 4) == 0 &&
+            memcmp(header.game_code, cart->header->game_code, 4) == 0 &&
+            header.header_checksum == cart->header->header_checksum &&
+            fread(secure, 1, CART_SECURE_SIZE, file) == CART_SECURE_SIZE;
+    fclose(file);
+
+    if (!valid) {
+        LOG(LOG_CART, LOG_WARN, "KEY1: %s belongs to another ROM, ignoring it", path);
+    }
+    return valid;
+}
+
+static void nds_cart_save_secure(nds_cartridge* cart, char* path, u32* secure)
+{
+    FILE* file = fopen(path, "wb");
+    nds_secure_file header = { .magic = "NDSK", .reserved = 0 };
+
+    memcpy(header.game_code, cart->header->game_code, 4);
+    header.header_checksum = cart->header->header_checksum;
+
+    if (file == NULL || fwrite(&header, sizeof(header), 1, file) != 1 ||
+        fwrite(secure, 1, CART_SECURE_SIZE, file) != CART_SECURE_SIZE) {
+        LOG(LOG_CART, LOG_ERROR, "KEY1: cannot write %s", path);
+    }
+    if (file != NULL) {
+        fclose(file);
+    }
+}
+
+// Makes an encrypted dump readable like a decrypted one. The Blowfish
+// work is only done once per ROM, afterwards the secure area comes from
+// the cache file. Its page of the private mapping becomes a copy.
+bool nds_cart_decrypt(nds_cartridge* cart, char* bios_path, char* cache_path)
+{
+    u32 secure[CART_SECURE_SIZE / 4];
+    long page = sysconf(_SC_PAGESIZE);
+    u8* start;
+    u32 length;
+
+    if (cart->type != CART_ENCRYPTED) {
+        return true;
+    }
+
+    if (!nds_cart_load_secure(cart, cache_path, secure)) {
+        nds_cart_read(cart, CART_SECURE_AREA, secure, CART_SECURE_SIZE);
+        if (!nds_cart_decrypt_secure(cart, bios_path, secure)) {
+            return false;
+        }
+        nds_cart_save_secure(cart, cache_path, secure);
+    }
+
+    if (cart->chunked != NULL) {
+        nds_chunked_patch(cart->chunked, CART_SECURE_AREA, secure, CART_SECURE_SIZE);
+    } else {
+        start = (u8*)((uintptr_t)(cart->rom + CART_SECURE_AREA) & ~(page - 1));
+        length = (cart->rom + CART_SECURE_AREA + CART_SECURE_SIZE) - start;
+
+        if (mprotect(start, length, PROT_READ | PROT_WRITE) != 0) {
+            LOG(LOG_CART, LOG_ERROR, "KEY1: cannot write to the mapping");
+            return false;
+        }
+        memcpy((u8*)cart->rom + CART_SECURE_AREA, secure, CART_SECURE_SIZE);
+        mprotect(start, length, PROT_READ);
+    }
+
     cart->type = CART_DUMPED;
+    LOG(LOG_CART, LOG_INFO, "KEY1: decrypted the secure area");
+    return true;
 }
 
-nds_cartridge* nds_cart_open(char* rom_path)
+// Boot reads the header and both binaries, start reading them early
+static void nds_cart_prefetch(nds_cartridge* cart, u32 offset, u32 size)
 {
-    // TODO: sanitize cartridge header, decrypt
-    nds_cartridge* cart = malloc(sizeof(nds_cartridge));
-    FILE* rom_handle = fopen(rom_path, "rb");
+    long page = sysconf(_SC_PAGESIZE);
+    u32 start = offset & ~(page - 1);
 
-    if (rom_handle == NULL) {
-        LOG(LOG_ERROR, "fopen: %s", rom_path);
-        free(cart);
+    if (offset < cart->size) {
+        if (size > cart->size - offset) {
+            size = cart->size - offset;
+        }
+        madvise((void*)(cart->rom + start), offset - start + size, MADV_WILLNEED);
+    }
+}
+
+static void* nds_cart_readahead_thread(void* object)
+{
+    nds_cartridge* cart = object;
+    long page = sysconf(_SC_PAGESIZE);
+
+    pthread_mutex_lock(&cart->readahead.lock);
+    while (cart->readahead.running) {
+        u32 offset = cart->readahead.offset;
+        u32 end;
+
+        if (cart->readahead.size == 0) {
+            pthread_cond_wait(&cart->readahead.wake, &cart->readahead.lock);
+            continue;
+        }
+
+        end = offset + cart->readahead.size < cart->size ? offset + cart->readahead.size : cart->size;
+        cart->readahead.size = 0;
+        pthread_mutex_unlock(&cart->readahead.lock);
+
+        // Touching each page faults it in here instead of on the guest's read
+        nds_cart_prefetch(cart, offset, end - offset);
+        for (u32 address = offset & ~(page - 1); address < end; address += page) {
+            (void)*(volatile const u8*)&cart->rom[address];
+        }
+
+        pthread_mutex_lock(&cart->readahead.lock);
+    }
+    pthread_mutex_unlock(&cart->readahead.lock);
+
+    return NULL;
+}
+
+// Asks for the CART_READAHEAD bytes behind offset without waiting for them.
+// Only the part the previous requests did not cover is handed over.
+void nds_cart_readahead(nds_cartridge* cart, u32 offset)
+{
+    u32 end = offset + CART_READAHEAD;
+
+    if (!cart->readahead.running || offset >= cart->size) {
+        return;
+    }
+
+    if (offset >= cart->readahead.from && offset <= cart->readahead.done) {
+        if (end <= cart->readahead.done) {
+            return;
+        }
+        offset = cart->readahead.done;
+    } else {
+        cart->readahead.from = offset;
+    }
+    cart->readahead.done = end;
+
+    pthread_mutex_lock(&cart->readahead.lock);
+    cart->readahead.offset = offset;
+    cart->readahead.size = end - offset;
+    pthread_cond_signal(&cart->readahead.wake);
+    pthread_mutex_unlock(&cart->readahead.lock);
+}
+
+nds_cartridge* nds_cart_open(char* rom_path, nds_cart_map flags)
+{
+    // TODO: sanitize cartridge header
+    nds_cartridge* cart;
+    struct stat status;
+    int map_flags = MAP_PRIVATE;
+    void* rom;
+    int fd = open(rom_path, O_RDONLY);
+
+    if (fd == -1) {
+        LOG(LOG_CART, LOG_ERROR, "open: %s", rom_path);
+        return NULL;
+    }
+
+    if (fstat(fd, &status) != 0 || status.st_size < sizeof(nds_header) || status.st_size > 0xFFFFFFFF) {
+        LOG(LOG_CART, LOG_ERROR, "%s is not a cartridge image", rom_path);
+        close(fd);
+        return NULL;
+    }
+
+#ifdef MAP_POPULATE
+    if (flags & CART_MAP_POPULATE) {
+        map_flags |= MAP_POPULATE;
+    }
+#endif
+
+    // The mapping keeps its own reference to the file
+    rom = mmap(NULL, status.st_size, PROT_READ, map_flags, fd, 0);
+    close(fd);
+    if (rom == MAP_FAILED) {
+        LOG(LOG_CART, LOG_ERROR, "mmap: %s", rom_path);
         return NULL;
     }
-    
-    if (fread(&cart->header, sizeof(nds_header), 1, rom_handle) != 1) {
-        LOG(LOG_ERROR, "fread: %s", rom_path);
-        fclose(rom_handle);
+
+#ifdef MADV_HUGEPAGE
+    if (flags & CART_MAP_HUGEPAGES) {
+        madvise(rom, status.st_size, MADV_HUGEPAGE);
+    }
+#endif
+
+    cart = calloc(1, sizeof(nds_cartridge));
+    cart->chunked = nds_chunked_open(rom, status.st_size);
+
+    if (cart->chunked != NULL) {
+        // Nothing to fault in ahead, the chunk cache does the buffering
+        cart->size = cart->chunked->size;
+        cart->header = malloc(sizeof(nds_header));
+        nds_cart_read(cart, 0, (void*)cart->header, sizeof(nds_header));
+    } else if (memcmp(rom, CHUNKED_MAGIC, 4) == 0) {
+        munmap(rom, status.st_size);
         free(cart);
         return NULL;
+    } else {
+        cart->rom = rom;
+        cart->size = status.st_size;
+        cart->header = rom;
     }
-    
-    cart->rom_handle = rom_handle;
     nds_cart_get_type(cart);
-    
+
+    // Corrupt images are rejected before anything else reads them
+    if (!nds_cart_verify(cart)) {
+        LOG(LOG_CART, LOG_ERROR, "%s is corrupt", rom_path);
+        nds_cart_close(cart);
+        return NULL;
+    }
+
+    if (cart->chunked == NULL && !(flags & CART_MAP_POPULATE)) {
+        nds_cart_prefetch(cart, cart->header->arm9.rom, cart->header->arm9.size);
+        nds_cart_prefetch(cart, cart->header->arm7.rom, cart->header->arm7.size);
+
+        pthread_mutex_init(&cart->readahead.lock, NULL);
+        pthread_cond_init(&cart->readahead.wake, NULL);
+        cart->readahead.running = true;
+        if (pthread_create(&cart->readahead.thread, NULL, nds_cart_readahead_thread, cart) != 0) {
+            cart->readahead.running = false;
+        }
+    }
+
     return cart;
 }
 
 void nds_cart_close(nds_cartridge* cart)
 {
-    fclose(cart->rom_handle);
+    if (cart->readahead.running) {
+        pthread_mutex_lock(&cart->readahead.lock);
+        cart->readahead.running = false;
+        pthread_cond_signal(&cart->readahead.wake);
+        pthread_mutex_unlock(&cart->readahead.lock);
+        pthread_join(cart->readahead.thread, NULL);
+    }
+
+    if (cart->chunked != NULL) {
+        munmap((void*)cart->chunked->file, cart->chunked->file_size);
+        nds_chunked_close(cart->chunked);
+        free((void*)cart->header);
+    } else {
+        munmap((void*)cart->rom, cart->size);
+    }
     free(cart);
 }
+
+// Returns size bytes at offset without copying them, NULL if they
+// are not all inside of the image. For compressed images this only
+// works within a chunk and lasts until the next read of the cartridge.
+const u8* nds_cart_slice(nds_cartridge* cart, u32 offset, u32 size)
+{
+    if (offset > cart->size || size > cart->size - offset) {
+        return NULL;
+    }
+    if (cart->chunked != NULL) {
+        return nds_chunked_slice(cart->chunked, offset, size);
+    }
+    return cart->rom + offset;
+}
+
+// Reads behind the end of the image return 0xFF like an open bus
+void nds_cart_read(nds_cartridge* cart, u32 offset, void* buffer, u32 size)
+{
+    u32 available = offset < cart->size ? cart->size - offset : 0;
+
+    if (available > size) {
+        available = size;
+    }
+    if (available != 0 && cart->chunked != NULL) {
+        nds_chunked_read(cart->chunked, offset, buffer, available);
+    } else if (available != 0) {
+        memcpy(buffer, cart->rom + offset, available);
+    }
+    memset((u8*)buffer + available, 0xFF, size - available);
+}
+
+// Chains size bytes at offset onto hash, see hash_fnv1a
+u64 nds_cart_hash(nds_cartridge* cart, u32 offset, u32 size, u64 hash)
+{
+    u8 buffer[0x4000];
+
+    while (size != 0) {
+        u32 length = size < sizeof(buffer) ? size : sizeof(buffer);
+
+        nds_cart_read(cart, offset, buffer, length);
+        hash = hash_fnv1a(hash, buffer, length);
+        offset += length;
+        size -= length;
+    }
+
+    return hash;
+}
@@ -23,10 +23,23 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
 #include "common/types.h"
+#include "nds_chunked.h"
 
 #define NDS_STRING(str, len) strcpy(calloc(len + 1, 1), str)
 
+// Reported by most retail cartridges, we do not emulate the chip
+#define NDS_CHIP_ID 0x00001FC2
+
+// The secure area, only the first 2KB of it are KEY1 encrypted
+#define CART_SECURE_AREA 0x4000
+#define CART_SECURE_SIZE 0x800
+#define CART_SECURE_ID 0xE7FFDEFF // replaces "encryObj" once decrypted
+
+// Sequential reads prefetch this far ahead of the guest
+#define CART_READAHEAD 0x10000
+
 #pragma pack(push, r1, 1)
 
 typedef enum {
@@ -93,13 +106,45 @@ typedef struct {
 
 #pragma pack(pop, r1)
 
+typedef enum {
+    CART_MAP_DEFAULT = 0,
+    CART_MAP_POPULATE = 1, // read the whole image up front
+    CART_MAP_HUGEPAGES = 2 // prefer transparent hugepages if the kernel can
+} nds_cart_map;
+
+// The image is mapped read-only and shared with the page cache,
+// so only the pages actually touched count towards the RSS. The
+// decrypted secure area is the only private copy.
+//
+// Compressed images are mapped the same way, but rom is NULL and
+// all reads go through the chunk cache.
 typedef struct {
-    nds_header header;
+    const nds_header* header; // points into rom, or a copy
     nds_cart_type type;
-    FILE* rom_handle;
+    const u8* rom;
+    u32 size;
+    nds_chunked* chunked;
+
+    // Faults in the pages ahead of sequential reads, so that slow
+    // storage does not stall the emulation thread.
+    struct {
+        pthread_t thread;
+        pthread_mutex_t lock;
+        pthread_cond_t wake;
+        bool running;
+        u32 offset;
+        u32 size;
+        u32 from; // range requested so far, only used by the caller
+        u32 done;
+    } readahead;
 } nds_cartridge;
 
-nds_cartridge* nds_cart_open(char* rom_path);
+nds_cartridge* nds_cart_open(char* rom_path, nds_cart_map flags);
 void nds_cart_close(nds_cartridge* cart);
+bool nds_cart_decrypt(nds_cartridge* cart, char* bios_path, char* cache_path);
+const u8* nds_cart_slice(nds_cartridge* cart, u32 offset, u32 size);
+void nds_cart_read(nds_cartridge* cart, u32 offset, void* buffer, u32 size);
+u64 nds_cart_hash(nds_cartridge* cart, u32 offset, u32 size, u64 hash);
+void nds_cart_readahead(nds_cartridge* cart, u32 offset);
 
 #endif
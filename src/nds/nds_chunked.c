@@ -0,0 +1,192 @@
+/*
+ * Copyright (C) 2016 Frederic Meyer
+ *
+ * This file is part of NoDS.
+ *
+ * NoDS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * NoDS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NoDS. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "common/log.h"
+#include "common/lz.h"
+#include "nds_chunked.h"
+
+#define CHUNK_NONE 0xFFFFFFFF
+
+// Takes over a mapping of the container, the caller unmaps it after close
+nds_chunked* nds_chunked_open(const u8* file, u32 file_size)
+{
+    const nds_chunked_header* header = (const nds_chunked_header*)file;
+    nds_chunked* chunked;
+    const u32* index;
+
+    if (file_size < sizeof(nds_chunked_header) || memcmp(header->magic, CHUNKED_MAGIC, 4) != 0) {
+        return NULL;
+    }
+
+    // Only the chunk size ndzpack writes keeps the cache within its bound
+    if (header->version != CHUNKED_VERSION || header->chunk_size != CHUNKED_CHUNK_SIZE ||
+        header->count != ((u64)header->size + CHUNKED_CHUNK_SIZE - 1) / CHUNKED_CHUNK_SIZE ||
+        (u64)header->count * 4 + 4 > file_size - sizeof(nds_chunked_header)) {
+        LOG(LOG_CART, LOG_ERROR, "CHUNKED: unsupported or broken container");
+        return NULL;
+    }
+
+    index = (const u32*)(file + sizeof(nds_chunked_header));
+    for (u32 chunk = 0; chunk < header->count; chunk++) {
+        if (index[chunk] > index[chunk + 1] || index[chunk + 1] > file_size) {
+            LOG(LOG_CART, LOG_ERROR, "CHUNKED: chunk %u lies outside of the file", chunk);
+            return NULL;
+        }
+    }
+
+    chunked = calloc(1, sizeof(nds_chunked));
+    chunked->file = file;
+    chunked->file_size = file_size;
+    chunked->index = index;
+    chunked->size = header->size;
+    chunked->chunk_size = header->chunk_size;
+    chunked->count = header->count;
+
+    for (int i = 0; i < CHUNKED_CACHE_SLOTS; i++) {
+        chunked->slots[i].chunk = CHUNK_NONE;
+    }
+
+    return chunked;
+}
+
+void nds_chunked_close(nds_chunked* chunked)
+{
+    for (int i = 0; i < CHUNKED_CACHE_SLOTS; i++) {
+        free(chunked->slots[i].data);
+    }
+    free(chunked->patch.data);
+    free(chunked);
+}
+
+static void nds_chunked_decompress(nds_chunked* chunked, u32 chunk, u8* data)
+{
+    u32 offset = chunk * chunked->chunk_size;
+    u32 length = chunked->size - offset < chunked->chunk_size ? chunked->size - offset : chunked->chunk_size;
+    const u8* source = chunked->file + chunked->index[chunk];
+    u32 source_size = chunked->index[chunk + 1] - chunked->index[chunk];
+    u32 start, end;
+
+    if (source_size == length) {
+        memcpy(data, source, length);
+    } else if (!lz_decompress(source, source_size, data, length)) {
+        LOG(LOG_CART, LOG_ERROR, "CHUNKED: chunk %u is corrupt", chunk);
+        memset(data, 0xFF, length);
+    }
+
+    // Overlap with the patch, if any
+    start = chunked->patch.offset > offset ? chunked->patch.offset : offset;
+    end = chunked->patch.offset + chunked->patch.size < offset + length ?
+          chunked->patch.offset + chunked->patch.size : offset + length;
+    if (start < end) {
+        memcpy(&data[start - offset], &chunked->patch.data[start - chunked->patch.offset], end - start);
+    }
+}
+
+// Returns the decompressed chunk, evicting the least recently used one.
+// NULL if there is no memory for it.
+static u8* nds_chunked_load(nds_chunked* chunked, u32 chunk)
+{
+    nds_chunked_slot* slot = chunked->recent;
+
+    if (slot == NULL || slot->chunk != chunk) {
+        nds_chunked_slot* victim = &chunked->slots[0];
+
+        slot = NULL;
+        for (int i = 0; i < CHUNKED_CACHE_SLOTS; i++) {
+            if (chunked->slots[i].chunk == chunk) {
+                slot = &chunked->slots[i];
+                break;
+            }
+            if (chunked->slots[i].used < victim->used) {
+                victim = &chunked->slots[i];
+            }
+        }
+
+        if (slot == NULL) {
+            slot = victim;
+            if (slot->data == NULL) {
+                slot->data = malloc(chunked->chunk_size);
+                if (slot->data == NULL) {
+                    LOG(LOG_CART, LOG_ERROR, "CHUNKED: cannot allocate a chunk");
+                    return NULL;
+                }
+            }
+            slot->chunk = chunk;
+            nds_chunked_decompress(chunked, chunk, slot->data);
+        }
+        chunked->recent = slot;
+    }
+
+    slot->used = ++chunked->clock;
+    return slot->data;
+}
+
+// Like nds_cart_slice, but only within a chunk. The pointer stays
+// valid until the next access evicts the chunk.
+const u8* nds_chunked_slice(nds_chunked* chunked, u32 offset, u32 size)
+{
+    u32 chunk = offset / chunked->chunk_size;
+    u32 start = offset % chunked->chunk_size;
+    u8* data;
+
+    if (size > chunked->chunk_size - start || (data = nds_chunked_load(chunked, chunk)) == NULL) {
+        return NULL;
+    }
+    return data + start;
+}
+
+// The range must lie inside of the image. Chunks which cannot be
+// loaded read as 0xFF like an open bus.
+void nds_chunked_read(nds_chunked* chunked, u32 offset, void* buffer, u32 size)
+{
+    u8* out = buffer;
+
+    while (size != 0) {
+        u32 start = offset % chunked->chunk_size;
+        u32 length = chunked->chunk_size - start < size ? chunked->chunk_size - start : size;
+        u8* data = nds_chunked_load(chunked, offset / chunked->chunk_size);
+
+        if (data != NULL) {
+            memcpy(out, data + start, length);
+        } else {
+            memset(out, 0xFF, length);
+        }
+        offset += length;
+        out += length;
+        size -= length;
+    }
+}
+
+void nds_chunked_patch(nds_chunked* chunked, u32 offset, const void* data, u32 size)
+{
+    free(chunked->patch.data);
+    chunked->patch.offset = offset;
+    chunked->patch.size = size;
+    chunked->patch.data = malloc(size);
+    memcpy(chunked->patch.data, data, size);
+
+    // Cached chunks do not have it yet
+    for (int i = 0; i < CHUNKED_CACHE_SLOTS; i++) {
+        chunked->slots[i].chunk = CHUNK_NONE;
+        chunked->slots[i].used = 0;
+    }
+    chunked->recent = NULL;
+}
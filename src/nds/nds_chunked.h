@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) 2016 Frederic Meyer
+ *
+ * This file is part of NoDS.
+ *
+ * NoDS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * NoDS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NoDS. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _NDS_CHUNKED_H_
+#define _NDS_CHUNKED_H_
+
+#include "common/types.h"
+
+// Compressed cartridge images. The image is split into chunks which are
+// compressed on their own, so any offset can be read by decompressing a
+// single chunk. Recently used chunks are kept in a small LRU cache.
+//
+// File layout: header, (count + 1) chunk offsets into the file, chunks.
+// A chunk whose compressed size equals its raw size is stored as is.
+
+#define CHUNKED_MAGIC "NDSZ"
+#define CHUNKED_VERSION 1
+#define CHUNKED_CHUNK_SIZE 0x10000
+#define CHUNKED_CACHE_SLOTS 32 // bounds the cache to 2MB
+
+typedef struct {
+    char magic[4];
+    u32 version;
+    u32 size; // of the raw image
+    u32 chunk_size;
+    u32 count;
+} nds_chunked_header;
+
+typedef struct {
+    u32 chunk;
+    u32 used; // time of the last access, for LRU
+    u8* data;
+} nds_chunked_slot;
+
+typedef struct {
+    const u8* file;
+    u32 file_size;
+    const u32* index;
+    u32 size;
+    u32 chunk_size;
+    u32 count;
+
+    nds_chunked_slot slots[CHUNKED_CACHE_SLOTS];
+    nds_chunked_slot* recent;
+    u32 clock;
+
+    // Replaces a range of the image, e.g. the decrypted secure area
+    struct {
+        u32 offset;
+        u32 size;
+        u8* data;
+    } patch;
+} nds_chunked;
+
+nds_chunked* nds_chunked_open(const u8* file, u32 file_size);
+void nds_chunked_close(nds_chunked* chunked);
+const u8* nds_chunked_slice(nds_chunked* chunked, u32 offset, u32 size);
+void nds_chunked_read(nds_chunked* chunked, u32 offset, void* buffer, u32 size);
+void nds_chunked_patch(nds_chunked* chunked, u32 offset, const void* data, u32 size);
+
+#endif
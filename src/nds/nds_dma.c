@@ -0,0 +1,198 @@
+/*
+ * Copyright (C) 2016 Frederic Meyer
+ *
+ * This file is part of NoDS.
+ *
+ * NoDS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * NoDS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NoDS. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include "common/log.h"
+#include "nds_mmu.h"
+
+static const nds_dma_timing nds7_dma_timing[4] = { DMA_IMMEDIATE, DMA_VBLANK, DMA_CART, DMA_WIFI };
+
+static inline int nds_dma_offset(nds_dma_step step, int unit)
+{
+    switch (step) {
+    case DMA_DECREMENT:
+        return -unit;
+    case DMA_FIXED:
+        return 0;
+    default:
+        return unit;
+    }
+}
+
+// Fills with a fixed source value, a memset if all of its bytes match
+static void nds_dma_fill(u8* dest, const u8* source, int unit, u32 length)
+{
+    if (memcmp(source, source + 1, unit - 1) == 0) {
+        memset(dest, source[0], length * unit);
+    } else if (unit == 4) {
+        u32 value;
+
+        memcpy(&value, source, 4);
+        for (u32 i = 0; i < length; i++) {
+            memcpy(&dest[i * 4], &value, 4);
+        }
+    } else {
+        for (u32 i = 0; i < length; i++) {
+            memcpy(&dest[i * 2], source, 2);
+        }
+    }
+}
+
+// Copies linear transfers between RAM on the host, false if it cannot
+static bool nds7_dma_fast(nds_mmu* mmu, nds_dma* dma, int unit, int source_step, int dest_step)
+{
+    u32 size = dma->length * unit;
+    u8* source;
+    u8* dest;
+
+    if (dest_step != unit || source_step < 0) {
+        return false;
+    }
+
+    source = nds7_map(mmu, dma->source_address, source_step == 0 ? unit : size, false);
+    if (source == NULL) {
+        return false;
+    }
+
+    // nds7_map reports the write to the code map, VRAM holds no code
+    dest = nds7_map(mmu, dma->dest_address, size, true);
+    if (dest == NULL) {
+        dest = nds7_map_vram(mmu, dma->dest_address, size);
+    }
+    if (dest == NULL) {
+        return false;
+    }
+
+    if (source_step == 0) {
+        nds_dma_fill(dest, source, unit, dma->length);
+    } else if (source + size <= dest || dest + size <= source || dest <= source) {
+        // Copying forward unit by unit over an overlap equals memmove
+        // unless the destination starts behind the source.
+        memmove(dest, source, size);
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+static void nds7_dma_run(nds_mmu* mmu, int index)
+{
+    nds_dma* dma = &mmu->dma[ARM7][index];
+    int unit = dma->control & DMA_WORD ? 4 : 2;
+    int dest_step = nds_dma_offset((dma->control >> 5) & 3, unit);
+    int source_step = nds_dma_offset((dma->control >> 7) & 3, unit);
+
+    dma->source_address &= ~(unit - 1);
+    dma->dest_address &= ~(unit - 1);
+
+    // Cycles are charged in bulk: two internal cycles to start, then one
+    // N and then S accesses per side, which already cover every unit
+    mmu->timestamp += 2 +
+        nds7_cycles(mmu, dma->source_address, unit, false, CYCLE_N) +
+        nds7_cycles(mmu, dma->dest_address, unit, true, CYCLE_N) +
+        (dma->length - 1) * (nds7_cycles(mmu, dma->source_address, unit, false, CYCLE_S) +
+                             nds7_cycles(mmu, dma->dest_address, unit, true, CYCLE_S));
+
+    if (nds7_dma_fast(mmu, dma, unit, source_step, dest_step)) {
+        dma->source_address += source_step * dma->length;
+        dma->dest_address += dest_step * dma->length;
+    } else {
+        // IO is involved, every unit goes through the handlers
+        for (u32 i = 0; i < dma->length; i++) {
+            if (unit == 4) {
+                nds7_write_word(mmu, dma->dest_address, nds7_read_word(mmu, dma->source_address));
+            } else {
+                nds7_write_hword(mmu, dma->dest_address, nds7_read_hword(mmu, dma->source_address));
+            }
+            dma->source_address += source_step;
+            dma->dest_address += dest_step;
+        }
+    }
+
+    if (((dma->control >> 5) & 3) == DMA_RELOAD) {
+        dma->dest_address = dma->dest;
+    }
+
+    if (!(dma->control & DMA_REPEAT) || dma->timing == DMA_IMMEDIATE) {
+        dma->control &= ~DMA_ENABLE;
+    }
+
+    if (dma->control & DMA_IRQ) {
+        mmu->interrupt_flag[ARM7] |= INT_DMA0 << index;
+    }
+}
+
+// Word counts of 0 mean the maximum, DMA3 has a 16-bit counter
+static inline u32 nds7_dma_length(nds_dma* dma, int index)
+{
+    if (index == 3) {
+        return dma->count == 0 ? 0x10000 : dma->count;
+    }
+    return (dma->count & 0x3FFF) == 0 ? 0x4000 : dma->count & 0x3FFF;
+}
+
+// Called when the enable bit was set, immediate transfers run right away
+void nds7_dma_enable(nds_mmu* mmu, int index)
+{
+    nds_dma* dma = &mmu->dma[ARM7][index];
+
+    dma->source_address = dma->source & (index == 0 ? 0x07FFFFFF : 0x0FFFFFFF);
+    dma->dest_address = dma->dest & (index == 3 ? 0x0FFFFFFF : 0x07FFFFFF);
+    dma->length = nds7_dma_length(dma, index);
+    dma->timing = nds7_dma_timing[(dma->control >> 12) & 3];
+
+    LOG(LOG_MMU, LOG_INFO, "DMA%d: 0x%x -> 0x%x, 0x%x units, timing %d (NDS7)",
+        index, dma->source_address, dma->dest_address, dma->length, dma->timing);
+
+    if (dma->timing == DMA_IMMEDIATE) {
+        nds7_dma_run(mmu, index);
+    }
+}
+
+// Starts the enabled channels waiting for timing. Cartridge transfers
+// move a block per data word the card has ready, until it has no more.
+void nds7_dma_trigger(nds_mmu* mmu, nds_dma_timing timing)
+{
+    for (int index = 0; index < 4; index++) {
+        nds_dma* dma = &mmu->dma[ARM7][index];
+
+        if (!(dma->control & DMA_ENABLE) || dma->timing != timing) {
+            continue;
+        }
+
+        if (timing != DMA_CART) {
+            dma->length = nds7_dma_length(dma, index);
+            nds7_dma_run(mmu, index);
+            continue;
+        }
+
+        while ((dma->control & DMA_ENABLE) && (mmu->cart_bus.romctrl & ROMCTRL_DATA_READY)) {
+            u32 position = mmu->cart_bus.position;
+
+            dma->length = nds7_dma_length(dma, index);
+            nds7_dma_run(mmu, index);
+
+            // Nothing read the data port, waiting would never end
+            if (mmu->cart_bus.position == position) {
+                break;
+            }
+        }
+    }
+}
@@ -0,0 +1,63 @@
+/*
+ * Copyright (C) 2016 Frederic Meyer
+ *
+ * This file is part of NoDS.
+ *
+ * NoDS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * NoDS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NoDS. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _NDS_DMA_H_
+#define _NDS_DMA_H_
+
+#include "common/types.h"
+
+// Start timings of both CPUs, the ARM7 only knows some of them
+typedef enum {
+    DMA_IMMEDIATE = 0,
+    DMA_VBLANK = 1,
+    DMA_HBLANK = 2,
+    DMA_CART = 3,
+    DMA_GEOMETRY = 4,
+    DMA_WIFI = 5
+} nds_dma_timing;
+
+typedef enum {
+    DMA_INCREMENT = 0,
+    DMA_DECREMENT = 1,
+    DMA_FIXED = 2,
+    DMA_RELOAD = 3 // increment, destination only
+} nds_dma_step;
+
+typedef enum {
+    DMA_REPEAT = 1 << 9,
+    DMA_WORD = 1 << 10,
+    DMA_IRQ = 1 << 14,
+    DMA_ENABLE = 1 << 15
+} nds_dma_control;
+
+typedef struct {
+    // Registers as written
+    u32 source;
+    u32 dest;
+    u16 count;
+    u16 control;
+
+    // Latched when the channel is enabled
+    u32 source_address;
+    u32 dest_address;
+    u32 length;
+    nds_dma_timing timing;
+} nds_dma;
+
+#endif
@@ -17,11 +17,112 @@
  * along with NoDS. If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <stdlib.h>
+#include <string.h>
 #include "nds_firmware.h"
 #include "common/log.h"
+#include "common/hash.h"
 
-// do some research on this value
-#define FIRMWARE_SIZE 262144
+// Reads the whole chip into image, a missing file gives an erased chip
+bool nds_firm_load(u8* image, char* path)
+{
+    FILE* file = fopen(path, "rb");
+
+    memset(image, 0xFF, FIRMWARE_SIZE);
+
+    if (file == NULL) {
+        LOG(LOG_FIRM, LOG_WARN, "SPI: FIRM: cannot open %s, using an erased chip", path);
+        return false;
+    }
+
+    if (fread(image, 1, FIRMWARE_SIZE, file) != FIRMWARE_SIZE) {
+        LOG(LOG_FIRM, LOG_WARN, "SPI: FIRM: %s is smaller than the chip", path);
+    }
+    fclose(file);
+
+    return true;
+}
+
+// Starts from shared if given, otherwise from the contents of path.
+// Changes are only written back to path by the instance that read it,
+// instances sharing an image keep theirs in memory.
+void nds_firm_open(nds_firmware* firmware, char* path, const u8* shared)
+{
+    firmware->path = NULL;
+    firmware->dirty_start = FIRMWARE_SIZE;
+    firmware->dirty_end = 0;
+    firmware->shared = shared != NULL;
+
+    if (shared != NULL) {
+        firmware->image = (u8*)shared;
+    } else {
+        firmware->image = malloc(FIRMWARE_SIZE);
+        if (path == NULL) {
+            memset(firmware->image, 0xFF, FIRMWARE_SIZE);
+            return;
+        }
+        if (!nds_firm_load(firmware->image, path)) {
+            return;
+        }
+        firmware->path = malloc(strlen(path) + 1);
+        strcpy(firmware->path, path);
+    }
+}
+
+// Writes programmed and erased bytes back to the file
+void nds_firm_close(nds_firmware* firmware)
+{
+    if (firmware->path != NULL && firmware->dirty_start < firmware->dirty_end) {
+        FILE* file = fopen(firmware->path, "r+b");
+        u32 size = firmware->dirty_end - firmware->dirty_start;
+
+        if (file == NULL || fseek(file, firmware->dirty_start, SEEK_SET) != 0 ||
+            fwrite(&firmware->image[firmware->dirty_start], 1, size, file) != size) {
+            LOG(LOG_FIRM, LOG_ERROR, "SPI: FIRM: cannot write back to %s", firmware->path);
+        } else {
+            LOG(LOG_FIRM, LOG_INFO, "SPI: FIRM: wrote back 0x%x bytes at 0x%x", size, firmware->dirty_start);
+        }
+
+        if (file != NULL) {
+            fclose(file);
+        }
+    }
+
+    if (!firmware->shared) {
+        free(firmware->image);
+    }
+    free(firmware->path);
+    firmware->image = NULL;
+    firmware->path = NULL;
+}
+
+// Must be called before [address, address + size) is changed
+static void nds_firm_dirty(nds_firmware* firmware, u32 address, u32 size)
+{
+    if (firmware->shared) {
+        u8* image = malloc(FIRMWARE_SIZE);
+
+        memcpy(image, firmware->image, FIRMWARE_SIZE);
+        firmware->image = image;
+        firmware->shared = false;
+    }
+
+    if (address < firmware->dirty_start) {
+        firmware->dirty_start = address;
+    }
+    if (address + size > firmware->dirty_end) {
+        firmware->dirty_end = address + size;
+    }
+}
+
+static void nds_firm_erase(nds_firmware* firmware, u32 size)
+{
+    u32 address = firmware->address & (FIRMWARE_SIZE - 1) & ~(size - 1);
+
+    nds_firm_dirty(firmware, address, size);
+    memset(&firmware->image[address], 0xFF, size);
+    LOG(LOG_FIRM, LOG_INFO, "SPI: FIRM: erased 0x%x bytes at 0x%x", size, address);
+}
 
 void nds_firm_next_cmd(nds_firmware* firmware)
 {
@@ -30,12 +131,32 @@ void nds_firm_next_cmd(nds_firmware* firmware)
     // the next written byte as the next command.
     firmware->status = FIRM_STAT_CMD;
     firmware->transfers = 0;
+
+    // Write enable is reset once a program or erase completes
+    switch (firmware->command) {
+    case FIRM_CMD_PW:
+    case FIRM_CMD_PP:
+    case FIRM_CMD_PE:
+    case FIRM_CMD_SE:
+        firmware->writable = false;
+        break;
+    }
+    firmware->command = 0;
 }
 
 void nds_firm_write(nds_firmware* firmware, u8 value)
 {
     int status = firmware->status;
 
+    // Streamed reads are most of the traffic, once the address is
+    // known every clocked byte is a single lookup into the image.
+    if (status == FIRM_STAT_READ) {
+        firmware->data = firmware->image[firmware->address];
+        firmware->address = (firmware->address + 1) & (FIRMWARE_SIZE - 1);
+        firmware->transfers++;
+        return;
+    }
+
     // *generally* sets data register to zero since
     // SPIDATA eventually is zero when submitting bytes that do
     // not produce any output to SPIDATA.
@@ -44,9 +165,9 @@ void nds_firm_write(nds_firmware* firmware, u8 value)
     // FLASH chip may be in deep sleep mode where it only
     // accepts RDP (0xAB) as command, which releases deep mode.
     if (firmware->status == FIRM_STAT_DEEP) {
-        LOG(LOG_INFO, "SPI: FIRM: transfer while being deep");
+        LOG(LOG_FIRM, LOG_INFO, "SPI: FIRM: transfer while being deep");
         if (value == FIRM_CMD_RDP) {
-            LOG(LOG_INFO, "SPI: FIRM: ok! woken up!");
+            LOG(LOG_FIRM, LOG_INFO, "SPI: FIRM: ok! woken up!");
             firmware->status = FIRM_STAT_IDLE;
         }
         return;
@@ -58,35 +179,59 @@ void nds_firm_write(nds_firmware* firmware, u8 value)
     // the time and e.g. STAT_ADDR must be scheduled before STAT_DUMMY
     // since the address should be read before ommiting the dummy byte.
     if (status == FIRM_STAT_CMD) {
+        firmware->command = value;
+
         switch (value) {
         case FIRM_CMD_WREN:
-            LOG(LOG_INFO, "SPI: FIRM: now writable");
+            LOG(LOG_FIRM, LOG_INFO, "SPI: FIRM: now writable");
             firmware->writable = true;
             firmware->status = FIRM_STAT_IDLE;
             break;
         case FIRM_CMD_WRDI:
-            LOG(LOG_INFO, "SPI: FIRM: now write-protected");
+            LOG(LOG_FIRM, LOG_INFO, "SPI: FIRM: now write-protected");
             firmware->writable = false;
             firmware->status = FIRM_STAT_IDLE;
             break;
         case FIRM_CMD_RDID:
-            LOG(LOG_INFO, "SPI: FIRM: reading JEDEC");
+            LOG(LOG_FIRM, LOG_INFO, "SPI: FIRM: reading JEDEC");
             firmware->status = FIRM_STAT_JEDEC;
             break;
+        case FIRM_CMD_RDSR:
+            firmware->status = FIRM_STAT_STATUS;
+            break;
         case FIRM_CMD_READ:
-            LOG(LOG_INFO, "SPI: FIRM: enabled read, waiting for address");
+            LOG(LOG_FIRM, LOG_INFO, "SPI: FIRM: enabled read, waiting for address");
             firmware->status = FIRM_STAT_READ | FIRM_STAT_ADDR;
             break;
         case FIRM_CMD_FAST:
-            LOG(LOG_INFO, "SPI: FIRM: enabled fast read, waiting for address");
+            LOG(LOG_FIRM, LOG_INFO, "SPI: FIRM: enabled fast read, waiting for address");
             firmware->status = FIRM_STAT_READ | FIRM_STAT_ADDR | FIRM_STAT_DUMMY;
             break;
+        case FIRM_CMD_PW:
+        case FIRM_CMD_PP:
+            if (!firmware->writable) {
+                LOG(LOG_FIRM, LOG_WARN, "SPI: FIRM: program while write-protected");
+                firmware->status = FIRM_STAT_IDLE;
+                break;
+            }
+            LOG(LOG_FIRM, LOG_INFO, "SPI: FIRM: enabled page program, waiting for address");
+            firmware->status = FIRM_STAT_WRITE | FIRM_STAT_ADDR;
+            break;
+        case FIRM_CMD_PE:
+        case FIRM_CMD_SE:
+            if (!firmware->writable) {
+                LOG(LOG_FIRM, LOG_WARN, "SPI: FIRM: erase while write-protected");
+                firmware->status = FIRM_STAT_IDLE;
+                break;
+            }
+            firmware->status = FIRM_STAT_ADDR;
+            break;
         case FIRM_CMD_DP:
-            LOG(LOG_INFO, "SPI: FIRM: going deep :(");
+            LOG(LOG_FIRM, LOG_INFO, "SPI: FIRM: going deep :(");
             firmware->status = FIRM_STAT_DEEP;
             break;
         default:
-            LOG(LOG_WARN, "SPI: FIRM: unsupported or bad command 0x%x", value);
+            LOG(LOG_FIRM, LOG_WARN, "SPI: FIRM: unsupported or bad command 0x%x", value);
             break;
         }
     } else if (status & FIRM_STAT_ADDR) {
@@ -99,43 +244,62 @@ void nds_firm_write(nds_firmware* firmware, u8 value)
             break;
         case 3:
             firmware->address = (firmware->address << 8) | value;
+            firmware->address &= FIRMWARE_SIZE - 1;
             firmware->status &= ~FIRM_STAT_ADDR;
-            LOG(LOG_INFO, "SPI: FIRM: address transfered (0x%x)", firmware->address);
+            LOG(LOG_FIRM, LOG_INFO, "SPI: FIRM: address transfered (0x%x)", firmware->address);
+
+            // Erases complete with the address
+            if (firmware->command == FIRM_CMD_PE) {
+                nds_firm_erase(firmware, FIRMWARE_PAGE);
+            } else if (firmware->command == FIRM_CMD_SE) {
+                nds_firm_erase(firmware, FIRMWARE_SECTOR);
+            }
             break;
         default:
-            LOG(LOG_ERROR, "SPI: FIRM: STAT_ADDR exceeds 3 transfers");
+            LOG(LOG_FIRM, LOG_ERROR, "SPI: FIRM: STAT_ADDR exceeds 3 transfers");
             break;
         }
     } else if (status & FIRM_STAT_DUMMY) {
-        status &= ~FIRM_STAT_DUMMY;
-        LOG(LOG_INFO, "SPI: FIRM: dummy byte (0x%x) ommited", value);
-    } else if (status == FIRM_STAT_READ) {
+        firmware->status &= ~FIRM_STAT_DUMMY;
+        LOG(LOG_FIRM, LOG_INFO, "SPI: FIRM: dummy byte (0x%x) ommited", value);
+    } else if (status == FIRM_STAT_WRITE) {
         u32 address = firmware->address;
 
-        fseek(firmware->file_handle, address, SEEK_SET);
-        fread(&firmware->data, 1, 1, firmware->file_handle);
-        firmware->address = (address + 1) % FIRMWARE_SIZE; // does this wrap over?
+        // Page write replaces bytes, page program can only clear bits
+        nds_firm_dirty(firmware, address, 1);
+        if (firmware->command == FIRM_CMD_PW) {
+            firmware->image[address] = value;
+        } else {
+            firmware->image[address] &= value;
+        }
 
-        LOG(LOG_INFO, "SPI: FIRM: read byte from 0x%x (=0x%x)", address, firmware->data);
+        // Wraps around within the page
+        firmware->address = (address & ~(FIRMWARE_PAGE - 1)) | ((address + 1) & (FIRMWARE_PAGE - 1));
     } else if (status == FIRM_STAT_JEDEC) {
         switch (firmware->transfers) {
         case 1:
             firmware->data = 0x20;
-            LOG(LOG_INFO, "SPI: FIRM: started JEDEC transfer...");
+            LOG(LOG_FIRM, LOG_INFO, "SPI: FIRM: started JEDEC transfer...");
             break;
         case 2: firmware->data = 0x50; break;
         case 3:
             firmware->data = 0x12;
             firmware->status = FIRM_STAT_IDLE;
-            LOG(LOG_INFO, "SPI: FIRM: finished JEDEC transfer");
+            LOG(LOG_FIRM, LOG_INFO, "SPI: FIRM: finished JEDEC transfer");
             break;
         }
     } else if (status == FIRM_STAT_STATUS) {
         firmware->data = firmware->writable ? 2 : 0;
-        LOG(LOG_INFO, "SPI: FIRM: read status register (0x%x)", firmware->data);
+        LOG(LOG_FIRM, LOG_INFO, "SPI: FIRM: read status register (0x%x)", firmware->data);
     } else if (status == FIRM_STAT_IDLE) {
-        LOG(LOG_WARN, "SPI: FIRM: transfer even though idling");
+        LOG(LOG_FIRM, LOG_WARN, "SPI: FIRM: transfer even though idling");
     }
 
     firmware->transfers++;
 }
+
+// Chains the firmware contents onto hash, e.g. to key saved states
+u64 nds_firm_hash(nds_firmware* firmware, u64 hash)
+{
+    return hash_fnv1a(hash, firmware->image, FIRMWARE_SIZE);
+}
@@ -46,19 +46,38 @@ typedef enum {
     FIRM_STAT_STATUS = 8,
     FIRM_STAT_READ = 16,
     FIRM_STAT_DUMMY = 32,
-    FIRM_STAT_DEEP = 64
+    FIRM_STAT_DEEP = 64,
+    FIRM_STAT_WRITE = 128
 } nds_firmware_state;
 
+#define FIRMWARE_SIZE 262144
+#define FIRMWARE_PAGE 256
+#define FIRMWARE_SECTOR 65536
+
 typedef struct {
-    FILE* file_handle;
+    // The whole chip is kept in memory, programmed and erased bytes
+    // are written back to path when the firmware is closed. A shared
+    // image belongs to the caller and is copied on the first change.
+    u8* image;
+    bool shared;
+    char* path;
+    u32 dirty_start;
+    u32 dirty_end;
+
     int transfers;
     int status;
+    int command;
     bool writable;
     u32 address;
     u8 data;
 } nds_firmware;
 
+bool nds_firm_load(u8* image, char* path);
+void nds_firm_open(nds_firmware* firmware, char* path, const u8* shared);
+void nds_firm_close(nds_firmware* firmware);
+
 void nds_firm_next_cmd(nds_firmware* firmware);
 void nds_firm_write(nds_firmware* firmware, u8 value);
+u64 nds_firm_hash(nds_firmware* firmware, u64 hash);
 
 #endif
@@ -0,0 +1,106 @@
+/*
+ * Copyright (C) 2016 Frederic Meyer
+ *
+ * This file is part of NoDS.
+ *
+ * NoDS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * NoDS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NoDS. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include "nds_key1.h"
+
+static inline u32 nds_key1_f(nds_key1* key1, u32 value)
+{
+    u32* table = key1->table;
+    u32 result;
+
+    result = table[0x012 + (value >> 24)];
+    result += table[0x112 + ((value >> 16) & 0xFF)];
+    result ^= table[0x212 + ((value >> 8) & 0xFF)];
+    result += table[0x312 + (value & 0xFF)];
+    return result;
+}
+
+// Encrypts a 64-bit block in place, data[1] holds the upper half
+void nds_key1_encrypt(nds_key1* key1, u32* data)
+{
+    u32 x = data[1];
+    u32 y = data[0];
+
+    for (int i = 0; i <= 0xF; i++) {
+        u32 z = key1->table[i] ^ x;
+        x = nds_key1_f(key1, z) ^ y;
+        y = z;
+    }
+
+    data[0] = x ^ key1->table[0x10];
+    data[1] = y ^ key1->table[0x11];
+}
+
+void nds_key1_decrypt(nds_key1* key1, u32* data)
+{
+    u32 x = data[1];
+    u32 y = data[0];
+
+    for (int i = 0x11; i >= 0x2; i--) {
+        u32 z = key1->table[i] ^ x;
+        x = nds_key1_f(key1, z) ^ y;
+        y = z;
+    }
+
+    data[0] = x ^ key1->table[0x1];
+    data[1] = y ^ key1->table[0x0];
+}
+
+// Mixes the key code into the P-array and regenerates all tables
+static void nds_key1_apply(nds_key1* key1, int modulo)
+{
+    u32 scratch[2] = { 0, 0 };
+
+    nds_key1_encrypt(key1, &key1->code[1]);
+    nds_key1_encrypt(key1, &key1->code[0]);
+
+    for (int i = 0; i <= 0x11; i++) {
+        key1->table[i] ^= __builtin_bswap32(key1->code[i % (modulo / 4)]);
+    }
+
+    for (int i = 0; i < KEY1_TABLE_SIZE; i += 2) {
+        nds_key1_encrypt(key1, scratch);
+        key1->table[i] = scratch[1];
+        key1->table[i + 1] = scratch[0];
+    }
+}
+
+// Level 2 and 3 are used by the secure area, level 1 by KEY1 commands
+void nds_key1_init(nds_key1* key1, const u32* key_buffer, u32 id_code, int level, int modulo)
+{
+    memcpy(key1->table, key_buffer, sizeof(key1->table));
+    key1->code[0] = id_code;
+    key1->code[1] = id_code >> 1;
+    key1->code[2] = id_code << 1;
+
+    if (level >= 1) {
+        nds_key1_apply(key1, modulo);
+    }
+    if (level >= 2) {
+        nds_key1_apply(key1, modulo);
+    }
+
+    key1->code[1] <<= 1;
+    key1->code[2] >>= 1;
+
+    if (level >= 3) {
+        nds_key1_apply(key1, modulo);
+    }
+}
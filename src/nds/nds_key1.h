@@ -0,0 +1,41 @@
+/*
+ * Copyright (C) 2016 Frederic Meyer
+ *
+ * This file is part of NoDS.
+ *
+ * NoDS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * NoDS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NoDS. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _NDS_KEY1_H_
+#define _NDS_KEY1_H_
+
+#include "common/types.h"
+
+// KEY1 is the Blowfish variant which protects the secure area. Its
+// tables are derived from the key buffer in the ARM7 BIOS and the
+// game code of the cartridge.
+
+#define KEY1_BIOS_OFFSET 0x30
+#define KEY1_TABLE_SIZE 0x412 // words, 18 P-array entries and 4 S-boxes
+
+typedef struct {
+    u32 table[KEY1_TABLE_SIZE];
+    u32 code[3];
+} nds_key1;
+
+void nds_key1_init(nds_key1* key1, const u32* key_buffer, u32 id_code, int level, int modulo);
+void nds_key1_encrypt(nds_key1* key1, u32* data);
+void nds_key1_decrypt(nds_key1* key1, u32* data);
+
+#endif
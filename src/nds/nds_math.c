@@ -0,0 +1,178 @@
+/*
+ * Copyright (C) 2016 Frederic Meyer
+ *
+ * This file is part of NoDS.
+ *
+ * NoDS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * NoDS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NoDS. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <math.h>
+#include "nds_math.h"
+
+static void nds_math_divide(nds_math* math)
+{
+    s64 numer;
+    s64 denom;
+
+    switch (math->divcnt & 3) {
+    case 0:
+        numer = (s32)math->numer;
+        denom = (s32)math->denom;
+        break;
+    case 2:
+        numer = math->numer;
+        denom = math->denom;
+        break;
+    default:
+        numer = math->numer;
+        denom = (s32)math->denom;
+        break;
+    }
+
+    // The flag looks at all 64 bits even in the 32-bit modes
+    if (math->denom == 0) {
+        math->divcnt |= 0x4000;
+    } else {
+        math->divcnt &= ~0x4000;
+    }
+
+    if (denom == 0) {
+        math->quotient = numer < 0 ? 1 : -1;
+        math->remainder = numer;
+
+        // The 32-bit divider inverts the upper half of the quotient
+        if ((math->divcnt & 3) == 0) {
+            math->quotient = (numer < 0 ? 0xFFFFFFFF00000000ULL : 0) | (u32)math->quotient;
+        }
+    } else if (denom == -1 && (u64)numer == ((math->divcnt & 3) == 0 ? 0xFFFFFFFF80000000ULL : 0x8000000000000000ULL)) {
+        // Overflows, the quotient is positive in the 32-bit mode
+        math->quotient = (math->divcnt & 3) == 0 ? 0x80000000ULL : (u64)numer;
+        math->remainder = 0;
+    } else {
+        math->quotient = numer / denom;
+        math->remainder = numer % denom;
+    }
+
+    math->div_dirty = false;
+}
+
+static void nds_math_sqrt(nds_math* math)
+{
+    u64 param = math->sqrtcnt & 1 ? math->param : (u32)math->param;
+    u64 root = sqrt((double)param);
+
+    // Doubles lose bits above 2^53, correct the rounded estimate. Near
+    // 2^64 it rounds up to 2^32 and the square would wrap.
+    if (root > 0xFFFFFFFF) {
+        root = 0xFFFFFFFF;
+    }
+    while (root * root > param) {
+        root--;
+    }
+    while ((root + 1) * (root + 1) <= param && root < 0xFFFFFFFF) {
+        root++;
+    }
+
+    math->root = root;
+    math->sqrt_dirty = false;
+}
+
+u8 nds_math_read(nds_math* math, u32 offset, u64 now)
+{
+    int shift = (offset & 7) * 8;
+
+    switch (offset & ~7) {
+    case MATH_DIVCNT:
+        if (offset >= MATH_DIVCNT + 2) {
+            return 0;
+        }
+        if (math->div_dirty) {
+            nds_math_divide(math);
+        }
+        if (now < math->div_start + ((math->divcnt & 3) == 0 ? MATH_DIV_CYCLES_32 : MATH_DIV_CYCLES_64)) {
+            return (math->divcnt | 0x8000) >> shift;
+        }
+        return math->divcnt >> shift;
+    case MATH_DIV_NUMER:
+        return math->numer >> shift;
+    case MATH_DIV_DENOM:
+        return math->denom >> shift;
+    case MATH_DIV_RESULT:
+        if (math->div_dirty) {
+            nds_math_divide(math);
+        }
+        return math->quotient >> shift;
+    case MATH_DIVREM_RESULT:
+        if (math->div_dirty) {
+            nds_math_divide(math);
+        }
+        return math->remainder >> shift;
+    case MATH_SQRTCNT:
+        if (offset >= MATH_SQRT_RESULT) {
+            if (math->sqrt_dirty) {
+                nds_math_sqrt(math);
+            }
+            return math->root >> ((offset - MATH_SQRT_RESULT) * 8);
+        }
+        if (offset >= MATH_SQRTCNT + 2) {
+            return 0;
+        }
+        if (now < math->sqrt_start + MATH_SQRT_CYCLES) {
+            return (math->sqrtcnt | 0x8000) >> shift;
+        }
+        return math->sqrtcnt >> shift;
+    case MATH_SQRT_PARAM:
+        return math->param >> shift;
+    }
+
+    return 0;
+}
+
+// Any write to the operands or the mode restarts the operation
+void nds_math_write(nds_math* math, u32 offset, u8 value, u64 now)
+{
+    int shift = (offset & 7) * 8;
+
+    switch (offset & ~7) {
+    case MATH_DIVCNT:
+        if (offset == MATH_DIVCNT) {
+            math->divcnt = (math->divcnt & ~3) | (value & 3);
+            math->div_dirty = true;
+            math->div_start = now;
+        }
+        break;
+    case MATH_DIV_NUMER:
+        math->numer = (math->numer & ~(0xFFULL << shift)) | ((u64)value << shift);
+        math->div_dirty = true;
+        math->div_start = now;
+        break;
+    case MATH_DIV_DENOM:
+        math->denom = (math->denom & ~(0xFFULL << shift)) | ((u64)value << shift);
+        math->div_dirty = true;
+        math->div_start = now;
+        break;
+    case MATH_SQRTCNT:
+        if (offset == MATH_SQRTCNT) {
+            math->sqrtcnt = (math->sqrtcnt & ~1) | (value & 1);
+            math->sqrt_dirty = true;
+            math->sqrt_start = now;
+        }
+        break;
+    case MATH_SQRT_PARAM:
+        math->param = (math->param & ~(0xFFULL << shift)) | ((u64)value << shift);
+        math->sqrt_dirty = true;
+        math->sqrt_start = now;
+        break;
+    }
+}
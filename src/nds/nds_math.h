@@ -0,0 +1,65 @@
+/*
+ * Copyright (C) 2016 Frederic Meyer
+ *
+ * This file is part of NoDS.
+ *
+ * NoDS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * NoDS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NoDS. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _NDS_MATH_H_
+#define _NDS_MATH_H_
+
+#include "common/types.h"
+
+// The ARM9 division and square root unit. Writes only store operands
+// and the timestamp, the result is computed once something reads it.
+// Busy is derived from the timestamp of the last write.
+
+#define MATH_DIV_CYCLES_32 18
+#define MATH_DIV_CYCLES_64 34
+#define MATH_SQRT_CYCLES 13
+
+// Offsets from DIVCNT at 0x04000280
+typedef enum {
+    MATH_DIVCNT = 0x00,
+    MATH_DIV_NUMER = 0x10,
+    MATH_DIV_DENOM = 0x18,
+    MATH_DIV_RESULT = 0x20,
+    MATH_DIVREM_RESULT = 0x28,
+    MATH_SQRTCNT = 0x30,
+    MATH_SQRT_RESULT = 0x34,
+    MATH_SQRT_PARAM = 0x38,
+    MATH_SIZE = 0x40
+} nds_math_reg;
+
+typedef struct {
+    u16 divcnt;
+    u64 numer;
+    u64 denom;
+    u64 quotient;
+    u64 remainder;
+    u64 div_start;
+    bool div_dirty;
+
+    u16 sqrtcnt;
+    u64 param;
+    u32 root;
+    u64 sqrt_start;
+    bool sqrt_dirty;
+} nds_math;
+
+u8 nds_math_read(nds_math* math, u32 offset, u64 now);
+void nds_math_write(nds_math* math, u32 offset, u8 value, u64 now);
+
+#endif
@@ -18,24 +18,41 @@
  */
 
 #include <stdlib.h>
+#include <sys/mman.h>
 #include "common/log.h"
 #include "nds_mmu.h"
 
-nds_mmu* nds_make_mmu()
+// Mapped rather than allocated, so that a savepoint can later replace
+// the pages with a private mapping of its own, see nds_savepoint_make
+nds_mmu* nds_make_mmu(char* firmware_path, const u8* firmware_image)
 {
-    nds_mmu* mmu = calloc(1, sizeof(nds_mmu));
+    nds_mmu* mmu = mmap(NULL, sizeof(nds_mmu), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (mmu == MAP_FAILED) {
+        LOG(LOG_MMU, LOG_ERROR, "MMU: cannot map 0x%x bytes", (u32)sizeof(nds_mmu));
+        return NULL;
+    }
 
     // Apparently the NDS7 core has access to both
     // SWRAM pages from the very beginning. Though
     // I'll have to do further investigation on this.
     mmu->wramcnt = ARM7_ALLOC_1ND | ARM7_ALLOC_2ND;
+    mmu->dtcm_base = 0x00800000;
+    mmu->code_pending_start = CODE_MAP_SIZE;
+    nds_timer_init(&mmu->timers[ARM7]);
+    nds_timer_init(&mmu->timers[ARM9]);
 
     // Initialize SPI master and slaves
-    nds_spi_init(&mmu->spi_bus);
+    nds_spi_init(&mmu->spi_bus, firmware_path, firmware_image);
 
     return mmu;
 }
 
+void nds_free_mmu(nds_mmu* mmu)
+{
+    munmap(mmu, sizeof(nds_mmu));
+}
+
 static inline u32 nds7_fifo_recv(nds_mmu* mmu)
 {
     nds_fifo* fifo = &mmu->fifo[ARM7];
@@ -82,6 +99,79 @@ static inline void nds7_fifo_send(nds_mmu* mmu, u32 value)
     }
 }
 
+// Raises the IRQs of timers which overflowed until now
+void nds7_timer_update(nds_mmu* mmu)
+{
+    u32 irq = nds_timer_update(&mmu->timers[ARM7], mmu->timestamp);
+
+    mmu->interrupt_flag[ARM7] |= irq * INT_TIMER0;
+}
+
+// There is no scheduler yet, so transfers complete as soon as the last
+// word was read and the IRQ is raised right away.
+static inline void nds7_cart_complete(nds_mmu* mmu)
+{
+    if (!(mmu->cart_bus.romctrl & ROMCTRL_START) && (mmu->auxspicnt & 0x4000)) {
+        mmu->interrupt_flag[ARM7] |= INT_SLOT1_COMPLETE;
+        LOG(LOG_CART, LOG_INFO, "CART: transfer complete IRQ (NDS7)");
+    }
+}
+
+// Offset into the code map of a pointer to MRAM, SWRAM or WRAM7, otherwise -1
+static inline int nds_code_offset(nds_mmu* mmu, u8* pointer)
+{
+    if (pointer >= mmu->mram && pointer < mmu->mram + sizeof(mmu->mram)) {
+        return pointer - mmu->mram;
+    }
+    if (pointer >= mmu->swram && pointer < mmu->swram + sizeof(mmu->swram)) {
+        return sizeof(mmu->mram) + (pointer - mmu->swram);
+    }
+    if (pointer >= mmu->wram7 && pointer < mmu->wram7 + sizeof(mmu->wram7)) {
+        return sizeof(mmu->mram) + sizeof(mmu->swram) + (pointer - mmu->wram7);
+    }
+    return -1;
+}
+
+static inline u8* nds_code_pointer(nds_mmu* mmu, int offset)
+{
+    if (offset < sizeof(mmu->mram)) {
+        return &mmu->mram[offset];
+    }
+    offset -= sizeof(mmu->mram);
+    if (offset < sizeof(mmu->swram)) {
+        return &mmu->swram[offset];
+    }
+    return &mmu->wram7[offset - sizeof(mmu->swram)];
+}
+
+// Must be called before [pointer, pointer + size) gets written to.
+// Decoded code in the affected chunks is reported to the code handler.
+static inline void nds_code_write(nds_mmu* mmu, u8* pointer, u32 size)
+{
+    int offset = nds_code_offset(mmu, pointer);
+
+    if (offset < 0) {
+        return;
+    }
+
+    for (int chunk = offset >> CODE_CHUNK_SHIFT; chunk <= (offset + size - 1) >> CODE_CHUNK_SHIFT; chunk++) {
+        if (mmu->code_map[chunk >> 3] & (1 << (chunk & 7))) {
+            mmu->code_map[chunk >> 3] &= ~(1 << (chunk & 7));
+
+            if (mmu->code_handler.method != NULL) {
+                u8* code = nds_code_pointer(mmu, chunk << CODE_CHUNK_SHIFT);
+                mmu->code_handler.method(mmu->code_handler.object, code, 1 << CODE_CHUNK_SHIFT);
+            }
+        }
+    }
+}
+
+static inline void nds_write_ram(nds_mmu* mmu, u8* pointer, u8 value)
+{
+    nds_code_write(mmu, pointer, 1);
+    *pointer = value;
+}
+
 int nds7_cycles(nds_mmu* mmu, u32 address, arm_size size, bool write, arm_cycle type)
 {
     return 1;
@@ -117,11 +207,39 @@ u8 nds7_read_byte(nds_mmu* mmu, u32 address)
 
         return 0;
     case 4: {
-        LOG(LOG_INFO, "MMU: IO: read register %x (NDS7)", address);
+        LOG(LOG_MMU, LOG_INFO, "MMU: IO: read register %x (NDS7)", address);
+
+        // Only the control register of a channel can be read
+        if (address >= NDS_DMA && address < NDS_DMA + 48) {
+            nds_dma* dma = &mmu->dma[ARM7][(address - NDS_DMA) / 12];
+
+            switch ((address - NDS_DMA) % 12) {
+            case 10:
+                return dma->control & 0xFF;
+            case 11:
+                return dma->control >> 8;
+            }
+            return 0;
+        }
+
+        // Counters are computed from the timestamp, the control byte is stored
+        if (address >= NDS_TIMER && address < NDS_TIMER + 16) {
+            int index = (address - NDS_TIMER) >> 2;
+
+            switch (address & 3) {
+            case 0:
+                return nds_timer_read(&mmu->timers[ARM7], index, mmu->timestamp) & 0xFF;
+            case 1:
+                return nds_timer_read(&mmu->timers[ARM7], index, mmu->timestamp) >> 8;
+            case 2:
+                return mmu->timers[ARM7].timer[index].control;
+            }
+            return 0;
+        }
 
         switch (address) {
         case NDS_IPCSYNC:
-            LOG(LOG_INFO, "IPC: SYNC: read input (%x) (NDS7)", mmu->sync[ARM7].data_in);
+            LOG(LOG_IPC, LOG_INFO, "IPC: SYNC: read input (%x) (NDS7)", mmu->sync[ARM7].data_in);
             return mmu->sync[ARM7].data_in;
         case NDS_IPCSYNC+1:
             return mmu->sync[ARM9].data_in |
@@ -148,7 +266,26 @@ u8 nds7_read_byte(nds_mmu* mmu, u32 address)
         case NDS_IPCFIFORECV+1:
         case NDS_IPCFIFORECV+2:
         case NDS_IPCFIFORECV+3:
-            LOG(LOG_ERROR, "IPC: FIFO: non-standard fifo read. unsupported. (NDS7)");
+            LOG(LOG_IPC, LOG_ERROR, "IPC: FIFO: non-standard fifo read. unsupported. (NDS7)");
+            return 0;
+        case NDS_AUXSPICNT:
+            return mmu->auxspicnt & 0xFF;
+        case NDS_AUXSPICNT+1:
+            return mmu->auxspicnt >> 8;
+        case NDS_AUXSPIDATA:
+            return mmu->auxspidata;
+        case NDS_AUXSPIDATA+1:
+            return 0;
+        case NDS_ROMCTRL:
+        case NDS_ROMCTRL+1:
+        case NDS_ROMCTRL+2:
+        case NDS_ROMCTRL+3:
+            return mmu->cart_bus.romctrl >> ((address - NDS_ROMCTRL) * 8);
+        case NDS_CARDDATA:
+        case NDS_CARDDATA+1:
+        case NDS_CARDDATA+2:
+        case NDS_CARDDATA+3:
+            LOG(LOG_CART, LOG_ERROR, "CART: non-standard data read. unsupported. (NDS7)");
             return 0;
         case NDS7_IO_SPICNT: {
             nds_spi_bus* spi_bus = &mmu->spi_bus;
@@ -201,6 +338,8 @@ u8 nds7_read_byte(nds_mmu* mmu, u32 address)
                    (mmu->vramcnt[VRAM_D].enable && mmu->vramcnt[VRAM_D].mst == 2);
         case NDS7_WRAMSTAT:
             return mmu->wramcnt;
+        case NDS_POSTFLG:
+            return mmu->postflg[ARM7];
         }
         return 0;
     }
@@ -212,7 +351,7 @@ u8 nds7_read_byte(nds_mmu* mmu, u32 address)
             address %= 0x40000;
 
             ASSERT(mmu->vramcnt[VRAM_C].offset == mmu->vramcnt[VRAM_D].offset,
-                   LOG_ERROR, "MMU: READ: weird VRAMCNT setting (NDS7)");
+                   LOG_MMU, LOG_ERROR, "MMU: READ: weird VRAMCNT setting (NDS7)");
 
             if (address < 0x20000) {
                 if (mmu->vramcnt[VRAM_C].offset == 0) {
@@ -239,13 +378,13 @@ u8 nds7_read_byte(nds_mmu* mmu, u32 address)
             return mmu->vram_d[address % 0x20000];
         }
 
-        LOG(LOG_ERROR, "MMU: READ: VRAM read but no VRAM mapped (NDS7)");
+        LOG(LOG_MMU, LOG_ERROR, "MMU: READ: VRAM read but no VRAM mapped (NDS7)");
 
         return 0;
     }
     }
 
-    LOG(LOG_ERROR, "MMU: READ: byte from %x (NDS7)", (page << 24) | address);
+    LOG(LOG_MMU, LOG_ERROR, "MMU: READ: byte from %x (NDS7)", (page << 24) | address);
 
     return 0;
 }
@@ -264,7 +403,16 @@ u32 nds7_read_word(nds_mmu* mmu, u32 address)
         switch (address & 0x00FFFFFF) {
         case NDS_IPCFIFORECV: {
             u32 value = nds7_fifo_recv(mmu);
-            LOG(LOG_INFO, "IPC: FIFO: dequeued 0x%x (NDS7)", value);
+            LOG(LOG_IPC, LOG_INFO, "IPC: FIFO: dequeued 0x%x (NDS7)", value);
+            return value;
+        }
+        case NDS_CARDDATA: {
+            bool busy = mmu->cart_bus.romctrl & ROMCTRL_START;
+            u32 value = nds_cart_bus_read(&mmu->cart_bus);
+
+            if (busy) {
+                nds7_cart_complete(mmu);
+            }
             return value;
         }
         }
@@ -283,46 +431,93 @@ void nds7_write_byte(nds_mmu* mmu, u32 address, u8 value)
 
     switch (page) {
     case 2:
-        mmu->mram[address % 0x400000] = value;
+        nds_write_ram(mmu, &mmu->mram[address % 0x400000], value);
         break;
     case 3:
         // Distinguish between WRAM7 area and SWRAM area.
         if (address >= 0x800000) {
-            mmu->wram7[(address - 0x800000) % 0x10000] = value;
+            nds_write_ram(mmu, &mmu->wram7[(address - 0x800000) % 0x10000], value);
             break;
         }
 
         // See nds7_read_byte for further explanation
         switch (mmu->wramcnt) {
         case 0:
-            mmu->wram7[address % 0x10000] = value;
+            nds_write_ram(mmu, &mmu->wram7[address % 0x10000], value);
             break;
         case ARM7_ALLOC_1ND:
-            mmu->swram[address % 0x4000] = value;
+            nds_write_ram(mmu, &mmu->swram[address % 0x4000], value);
             break;
         case ARM7_ALLOC_2ND:
-            mmu->swram[address % 0x4000 + 0x4000] = value;
+            nds_write_ram(mmu, &mmu->swram[address % 0x4000 + 0x4000], value);
             break;
         case ARM7_ALLOC_1ND|ARM7_ALLOC_2ND:
-            mmu->swram[address % 0x8000] = value;
+            nds_write_ram(mmu, &mmu->swram[address % 0x8000], value);
             break;
         }
 
         break;
     case 4: {
-        LOG(LOG_INFO, "MMU: IO: write register %x=%x (NDS7)", address, value);
+        LOG(LOG_MMU, LOG_INFO, "MMU: IO: write register %x=%x (NDS7)", address, value);
+
+        if (address >= NDS_DMA && address < NDS_DMA + 48) {
+            int index = (address - NDS_DMA) / 12;
+            int offset = (address - NDS_DMA) % 12;
+            nds_dma* dma = &mmu->dma[ARM7][index];
+
+            if (offset < 4) {
+                dma->source = (dma->source & ~(0xFFu << (offset * 8))) | (value << (offset * 8));
+            } else if (offset < 8) {
+                dma->dest = (dma->dest & ~(0xFFu << ((offset - 4) * 8))) | (value << ((offset - 4) * 8));
+            } else if (offset < 10) {
+                dma->count = (dma->count & ~(0xFF << ((offset - 8) * 8))) | (value << ((offset - 8) * 8));
+            } else if (offset == 10) {
+                dma->control = (dma->control & 0xFF00) | (value & 0xE0);
+            } else {
+                bool enabled = !(dma->control & DMA_ENABLE) && (value & 0x80);
+
+                dma->control = (dma->control & 0xFF) | ((value & 0xF7) << 8);
+                if (enabled) {
+                    nds7_dma_enable(mmu, index);
+                }
+            }
+            break;
+        }
+
+        if (address >= NDS_TIMER && address < NDS_TIMER + 16) {
+            nds_timer* timer = &mmu->timers[ARM7].timer[(address - NDS_TIMER) >> 2];
+
+            switch (address & 3) {
+            case 0:
+                timer->reload = (timer->reload & 0xFF00) | value;
+                break;
+            case 1:
+                timer->reload = (timer->reload & 0xFF) | (value << 8);
+                break;
+            case 2:
+                // Overflows up to now still happen with the old setting
+                if (mmu->timestamp >= mmu->timers[ARM7].next_event) {
+                    nds7_timer_update(mmu);
+                }
+                nds_timer_write_control(&mmu->timers[ARM7], (address - NDS_TIMER) >> 2, value & 0xC7, mmu->timestamp);
+                break;
+            }
+            break;
+        }
 
         switch (address) {
         case NDS_IPCSYNC+1:
-            LOG(LOG_INFO, "IPC: SYNC: write output (%x) (NDS7)", value & 0xF);
+            LOG(LOG_IPC, LOG_INFO, "IPC: SYNC: write output (%x) (NDS7)", value & 0xF);
 
             mmu->sync[ARM7].allow_irq = value & 64;
             mmu->sync[ARM9].data_in = value & 0xF;
 
-            // Trigger SYNC interrupt on remote cpu if neccessary
+            // Trigger SYNC interrupt on remote cpu if neccessary. The ARM9
+            // does not decode IPCSYNC yet, so allow_irq stays false. Once
+            // it does, this must wait for the turn barrier like code writes.
             if ((value & 32) && mmu->sync[ARM9].allow_irq) {
                 mmu->interrupt_flag[ARM9] |= INT_IPC_SYNC;
-                LOG(LOG_INFO, "IPC: SYNC: generate remote IRQ (NDS7)");
+                LOG(LOG_IPC, LOG_INFO, "IPC: SYNC: generate remote IRQ (NDS7)");
             }
             break;
         case NDS_IPCFIFOCNT: {
@@ -354,7 +549,57 @@ void nds7_write_byte(nds_mmu* mmu, u32 address, u8 value)
         case NDS_IPCFIFOSEND+1:
         case NDS_IPCFIFOSEND+2:
         case NDS_IPCFIFOSEND+3:
-            LOG(LOG_ERROR, "IPC: FIFO: non-standard fifo write. unsupported. (NDS7)");
+            LOG(LOG_IPC, LOG_ERROR, "IPC: FIFO: non-standard fifo write. unsupported. (NDS7)");
+            break;
+        case NDS_AUXSPICNT:
+            // Baud rate and chip select hold, never busy
+            mmu->auxspicnt = (mmu->auxspicnt & 0xFF00) | (value & 0x43);
+            break;
+        case NDS_AUXSPICNT+1:
+            mmu->auxspicnt = (mmu->auxspicnt & 0xFF) | ((value & 0xE0) << 8);
+            break;
+        case NDS_AUXSPIDATA:
+            // Needs the slot enabled and in backup (SPI) mode
+            if (mmu->backup == NULL || (mmu->auxspicnt & 0xA000) != 0xA000) {
+                mmu->auxspidata = 0xFF;
+                break;
+            }
+            mmu->auxspidata = nds_backup_transfer(mmu->backup, value);
+            if (!(mmu->auxspicnt & 0x40)) {
+                nds_backup_release(mmu->backup);
+            }
+            break;
+        case NDS_ROMCTRL:
+        case NDS_ROMCTRL+1:
+        case NDS_ROMCTRL+2:
+        case NDS_ROMCTRL+3: {
+            nds_cart_bus* cart_bus = &mmu->cart_bus;
+            int n = (address - NDS_ROMCTRL) * 8;
+            u32 mask = (0xFFu << n) & ~(ROMCTRL_START | ROMCTRL_DATA_READY);
+
+            cart_bus->romctrl = (cart_bus->romctrl & ~mask) | ((value << n) & mask);
+
+            // Only starts a transfer with the slot enabled and in ROM mode
+            if ((value & 0x80) && address == NDS_ROMCTRL+3 && !(cart_bus->romctrl & ROMCTRL_START)) {
+                if ((mmu->auxspicnt & 0xA000) != 0x8000) {
+                    LOG(LOG_CART, LOG_WARN, "CART: transfer while not in ROM mode (NDS7)");
+                    break;
+                }
+                nds_cart_bus_start(cart_bus);
+                nds7_cart_complete(mmu);
+                nds7_dma_trigger(mmu, DMA_CART);
+            }
+            break;
+        }
+        case NDS_CARDCMD:
+        case NDS_CARDCMD+1:
+        case NDS_CARDCMD+2:
+        case NDS_CARDCMD+3:
+        case NDS_CARDCMD+4:
+        case NDS_CARDCMD+5:
+        case NDS_CARDCMD+6:
+        case NDS_CARDCMD+7:
+            mmu->cart_bus.command[address - NDS_CARDCMD] = value;
             break;
         case NDS7_IO_SPICNT: {
             nds_spi_bus* spi_bus = &mmu->spi_bus;
@@ -412,6 +657,17 @@ void nds7_write_byte(nds_mmu* mmu, u32 address, u8 value)
             mmu->interrupt_flag[0] &= ~(value << n);
             break;
         }
+        case NDS_POSTFLG:
+            // Can be set but not cleared again
+            mmu->postflg[ARM7] |= value & 1;
+            break;
+        case NDS7_HALTCNT:
+            // 2=halt, 3=sleep. Sleep also only ends with an IRQ here.
+            if (value & 0x80) {
+                LOG(LOG_CPU, LOG_INFO, "NDS7: halted (HALTCNT=0x%x)", value);
+                mmu->halted[ARM7] = true;
+            }
+            break;
         }
         break;
     }
@@ -423,7 +679,7 @@ void nds7_write_byte(nds_mmu* mmu, u32 address, u8 value)
             address %= 0x40000;
 
             ASSERT(mmu->vramcnt[VRAM_C].offset == mmu->vramcnt[VRAM_D].offset,
-                   LOG_ERROR, "MMU: WRITE: weird VRAMCNT setting (NDS7)");
+                   LOG_MMU, LOG_ERROR, "MMU: WRITE: weird VRAMCNT setting (NDS7)");
 
             if (address < 0x20000) {
                 if (mmu->vramcnt[VRAM_C].offset == 0) {
@@ -456,7 +712,7 @@ void nds7_write_byte(nds_mmu* mmu, u32 address, u8 value)
             break;
         }
 
-        LOG(LOG_ERROR, "MMU: WRITE: VRAM write but no VRAM mapped (NDS7)");
+        LOG(LOG_MMU, LOG_ERROR, "MMU: WRITE: VRAM write but no VRAM mapped (NDS7)");
         break;
     }
     // NoDS debug port (FFXXXXXXh)
@@ -464,7 +720,7 @@ void nds7_write_byte(nds_mmu* mmu, u32 address, u8 value)
         printf("%c", value);
         break;
     default:
-        LOG(LOG_ERROR, "MMU: WRITE: set byte to %x=%x (NDS7)", (page << 24) | address, value);
+        LOG(LOG_MMU, LOG_ERROR, "MMU: WRITE: set byte to %x=%x (NDS7)", (page << 24) | address, value);
     }
 }
 
@@ -482,7 +738,7 @@ void nds7_write_word(nds_mmu* mmu, u32 address, u32 value)
         switch (address & 0x00FFFFFF) {
         case NDS_IPCFIFOSEND:
             nds7_fifo_send(mmu, value);
-            LOG(LOG_INFO, "IPC: FIFO: enqueue 0x%x (NDS7)", value);
+            LOG(LOG_IPC, LOG_INFO, "IPC: FIFO: enqueue 0x%x (NDS7)", value);
             return;
         }
     }
@@ -492,3 +748,269 @@ void nds7_write_word(nds_mmu* mmu, u32 address, u32 value)
     nds7_write_byte(mmu, address + 2, (value >> 16) & 0xFF);
     nds7_write_byte(mmu, address + 3, (value >> 24) & 0xFF);
 }
+
+static inline u8* nds_map_mirror(u8* memory, u32 length, u32 address, u32 size)
+{
+    u32 offset = address % length;
+
+    // The range must not wrap around the end of the mirror
+    if (offset + size > length) {
+        return NULL;
+    }
+
+    return &memory[offset];
+}
+
+static u8* nds7_map_ram(nds_mmu* mmu, u32 address, u32 size)
+{
+    int page = address >> 24;
+    address &= 0x00FFFFFF;
+
+    // Only plain RAM can be accessed directly, everything
+    // else must go through the read/write handlers.
+    switch (page) {
+    case 2:
+        return nds_map_mirror(mmu->mram, 0x400000, address, size);
+    case 3:
+        if (address >= 0x800000) {
+            return nds_map_mirror(mmu->wram7, 0x10000, address - 0x800000, size);
+        }
+
+        // See nds7_read_byte for further explanation
+        switch (mmu->wramcnt) {
+        case 0:
+            return nds_map_mirror(mmu->wram7, 0x10000, address, size);
+        case ARM7_ALLOC_1ND:
+            return nds_map_mirror(mmu->swram, 0x4000, address, size);
+        case ARM7_ALLOC_2ND:
+            return nds_map_mirror(mmu->swram + 0x4000, 0x4000, address, size);
+        case ARM7_ALLOC_1ND|ARM7_ALLOC_2ND:
+            return nds_map_mirror(mmu->swram, 0x8000, address, size);
+        }
+        return NULL;
+    }
+
+    return NULL;
+}
+
+u8* nds7_map(nds_mmu* mmu, u32 address, u32 size, bool write)
+{
+    u8* memory = nds7_map_ram(mmu, address, size);
+
+    // The caller writes to the memory directly, so report it beforehand
+    if (write && memory != NULL) {
+        nds_code_write(mmu, memory, size);
+    }
+
+    return memory;
+}
+
+// ARM7 VRAM, for DMA only: it is not tracked in the code map
+u8* nds7_map_vram(nds_mmu* mmu, u32 address, u32 size)
+{
+    bool vram_c_mapped = mmu->vramcnt[VRAM_C].enable && mmu->vramcnt[VRAM_C].mst == 2;
+    bool vram_d_mapped = mmu->vramcnt[VRAM_D].enable && mmu->vramcnt[VRAM_D].mst == 2;
+
+    if ((address >> 24) != 6) {
+        return NULL;
+    }
+    address &= 0x00FFFFFF;
+
+    // See nds7_read_byte for further explanation
+    if (vram_c_mapped && vram_d_mapped) {
+        int slot = (address % 0x40000) >= 0x20000;
+
+        if (mmu->vramcnt[VRAM_C].offset == slot) {
+            return nds_map_mirror(mmu->vram_c, 0x20000, address, size);
+        }
+        if (mmu->vramcnt[VRAM_D].offset == slot) {
+            return nds_map_mirror(mmu->vram_d, 0x20000, address, size);
+        }
+    } else if (vram_c_mapped) {
+        return nds_map_mirror(mmu->vram_c, 0x20000, address, size);
+    } else if (vram_d_mapped) {
+        return nds_map_mirror(mmu->vram_d, 0x20000, address, size);
+    }
+
+    return NULL;
+}
+
+void nds7_watch(nds_mmu* mmu, u8* code, u32 size)
+{
+    int offset = nds_code_offset(mmu, code);
+
+    if (offset < 0) {
+        return;
+    }
+
+    for (int chunk = offset >> CODE_CHUNK_SHIFT; chunk <= (offset + size - 1) >> CODE_CHUNK_SHIFT; chunk++) {
+        mmu->code_map[chunk >> 3] |= 1 << (chunk & 7);
+    }
+}
+
+// Only collects the chunks while the ARM9 runs on its own thread
+static inline void nds9_code_write(nds_mmu* mmu, u8* pointer, u32 size)
+{
+    int offset;
+
+    if (!mmu->code_deferred) {
+        nds_code_write(mmu, pointer, size);
+        return;
+    }
+
+    offset = nds_code_offset(mmu, pointer);
+    if (offset < 0) {
+        return;
+    }
+
+    for (int chunk = offset >> CODE_CHUNK_SHIFT; chunk <= (offset + size - 1) >> CODE_CHUNK_SHIFT; chunk++) {
+        mmu->code_pending[chunk >> 3] |= 1 << (chunk & 7);
+    }
+    if ((offset >> CODE_CHUNK_SHIFT >> 3) < mmu->code_pending_start) {
+        mmu->code_pending_start = offset >> CODE_CHUNK_SHIFT >> 3;
+    }
+    if (((offset + size - 1) >> CODE_CHUNK_SHIFT >> 3) >= mmu->code_pending_end) {
+        mmu->code_pending_end = ((offset + size - 1) >> CODE_CHUNK_SHIFT >> 3) + 1;
+    }
+}
+
+// Reports the decoded code the ARM9 thread wrote to, the ARM9 must wait
+void nds_code_sync(nds_mmu* mmu)
+{
+    for (int i = mmu->code_pending_start; i < mmu->code_pending_end; i++) {
+        u8 chunks = mmu->code_pending[i] & mmu->code_map[i];
+
+        mmu->code_pending[i] = 0;
+        for (int bit = 0; chunks != 0; bit++, chunks >>= 1) {
+            if (chunks & 1) {
+                nds_code_write(mmu, nds_code_pointer(mmu, ((i << 3) + bit) << CODE_CHUNK_SHIFT), 1);
+            }
+        }
+    }
+
+    mmu->code_pending_start = CODE_MAP_SIZE;
+    mmu->code_pending_end = 0;
+}
+
+// Same as nds7_map for the ARM9 side, used to place the ARM9 binary
+u8* nds9_map(nds_mmu* mmu, u32 address, u32 size, bool write)
+{
+    u8* memory = NULL;
+
+    // DTCM lies above ITCM
+    if (address - mmu->dtcm_base < sizeof(mmu->dtcm)) {
+        return nds_map_mirror(mmu->dtcm, sizeof(mmu->dtcm), address - mmu->dtcm_base, size);
+    }
+
+    switch (address >> 24) {
+    case 0:
+    case 1:
+        return nds_map_mirror(mmu->itcm, sizeof(mmu->itcm), address, size);
+    case 2:
+        memory = nds_map_mirror(mmu->mram, 0x400000, address & 0x00FFFFFF, size);
+        break;
+    case 3:
+        // The ARM9 gets the SWRAM pages the ARM7 does not have
+        switch (mmu->wramcnt) {
+        case 0:
+            memory = nds_map_mirror(mmu->swram, 0x8000, address & 0x00FFFFFF, size);
+            break;
+        case ARM7_ALLOC_1ND:
+            memory = nds_map_mirror(mmu->swram + 0x4000, 0x4000, address & 0x00FFFFFF, size);
+            break;
+        case ARM7_ALLOC_2ND:
+            memory = nds_map_mirror(mmu->swram, 0x4000, address & 0x00FFFFFF, size);
+            break;
+        }
+        break;
+    }
+
+    // MRAM and SWRAM may hold code decoded for the ARM7
+    if (write && memory != NULL) {
+        nds9_code_write(mmu, memory, size);
+    }
+
+    return memory;
+}
+
+int nds9_cycles(nds_mmu* mmu, u32 address, arm_size size, bool write, arm_cycle type)
+{
+    return 1;
+}
+
+// The ARM9 bus only knows memory and the math unit so far
+u8 nds9_read_byte(nds_mmu* mmu, u32 address)
+{
+    u8* memory = nds9_map(mmu, address, 1, false);
+
+    if (memory != NULL) {
+        return *memory;
+    }
+
+    if ((address >> 24) == 4) {
+        address &= 0x00FFFFFF;
+
+        if (address >= NDS9_DIVCNT && address < NDS9_DIVCNT + MATH_SIZE) {
+            return nds_math_read(&mmu->math, address - NDS9_DIVCNT, mmu->timestamp9);
+        }
+
+        LOG(LOG_MMU, LOG_INFO, "MMU: IO: read register %x (NDS9)", address);
+        return 0;
+    }
+
+    LOG(LOG_MMU, LOG_ERROR, "MMU: READ: byte from %x (NDS9)", address);
+
+    return 0;
+}
+
+u16 nds9_read_hword(nds_mmu* mmu, u32 address)
+{
+    return nds9_read_byte(mmu, address) |
+           (nds9_read_byte(mmu, address+1) << 8);
+}
+
+u32 nds9_read_word(nds_mmu* mmu, u32 address)
+{
+    return nds9_read_byte(mmu, address) |
+           (nds9_read_byte(mmu, address+1) << 8) |
+           (nds9_read_byte(mmu, address+2) << 16) |
+           (nds9_read_byte(mmu, address+3) << 24);
+}
+
+void nds9_write_byte(nds_mmu* mmu, u32 address, u8 value)
+{
+    u8* memory = nds9_map(mmu, address, 1, true);
+
+    if (memory != NULL) {
+        *memory = value;
+        return;
+    }
+
+    if ((address >> 24) == 4) {
+        address &= 0x00FFFFFF;
+
+        if (address >= NDS9_DIVCNT && address < NDS9_DIVCNT + MATH_SIZE) {
+            nds_math_write(&mmu->math, address - NDS9_DIVCNT, value, mmu->timestamp9);
+            return;
+        }
+
+        LOG(LOG_MMU, LOG_INFO, "MMU: IO: write register %x=%x (NDS9)", address, value);
+        return;
+    }
+
+    LOG(LOG_MMU, LOG_ERROR, "MMU: WRITE: set byte to %x=%x (NDS9)", address, value);
+}
+
+void nds9_write_hword(nds_mmu* mmu, u32 address, u16 value)
+{
+    nds9_write_byte(mmu, address, value & 0xFF);
+    nds9_write_byte(mmu, address + 1, value >> 8);
+}
+
+void nds9_write_word(nds_mmu* mmu, u32 address, u32 value)
+{
+    nds9_write_byte(mmu, address, value & 0xFF);
+    nds9_write_byte(mmu, address + 1, (value >> 8) & 0xFF);
+    nds9_write_byte(mmu, address + 2, (value >> 16) & 0xFF);
+    nds9_write_byte(mmu, address + 3, (value >> 24) & 0xFF);
+}
@@ -23,9 +23,18 @@
 #include "common/types.h"
 #include "arm/arm_cpu.h"
 #include "nds_spi.h"
+#include "nds_backup.h"
+#include "nds_cartbus.h"
+#include "nds_timer.h"
+#include "nds_dma.h"
+#include "nds_math.h"
 
 #define FIFO_SIZE 16
 
+// Decoded code is tracked in chunks of 128 bytes of MRAM, SWRAM and WRAM7
+#define CODE_CHUNK_SHIFT 7
+#define CODE_MAP_SIZE ((0x400000 + 0x8000 + 0x10000) >> CODE_CHUNK_SHIFT >> 3)
+
 typedef enum {
     ARM7 = 0,
     ARM9 = 1
@@ -33,15 +42,25 @@ typedef enum {
 
 // fix name inconsisties
 typedef enum {
+    NDS_DMA = 0xB0, // four times SAD, DAD, CNT_L and CNT_H
+    NDS_TIMER = 0x100, // four times TMCNT_L and TMCNT_H
     NDS_IPCSYNC = 0x180,
     NDS_IPCFIFOCNT = 0x184,
     NDS_IPCFIFOSEND = 0x188,
     NDS_IPCFIFORECV = 0x100000,
+    NDS_AUXSPICNT = 0x1A0,
+    NDS_AUXSPIDATA = 0x1A2,
+    NDS_ROMCTRL = 0x1A4,
+    NDS_CARDCMD = 0x1A8,
+    NDS_CARDDATA = 0x100010,
     NDS7_IO_SPICNT = 0x1C0,
     NDS7_IO_SPIDATA = 0x1C2,
     NDS_IO_IME = 0x208,
     NDS_IO_IE = 0x210,
     NDS_IO_IF = 0x214,
+    NDS_POSTFLG = 0x300,
+    NDS7_HALTCNT = 0x301,
+    NDS9_DIVCNT = 0x280, // start of the math unit
     NDS7_VRAMSTAT = 0x240,
     NDS7_WRAMSTAT = 0x241
 } nds_io_reg;
@@ -114,6 +133,8 @@ typedef struct {
     int write_index;
 } nds_fifo;
 
+typedef void (*nds_code_func)(void* object, u8* code, u32 size);
+
 typedef struct {
     // Memory Control
     int wramcnt;
@@ -124,6 +145,25 @@ typedef struct {
     u32 interrupt_enable[2];
     u32 interrupt_flag[2];
 
+    // Set by HALTCNT and the Halt/IntrWait SWIs, the CPU is
+    // not stepped again until IE&IF is non-zero.
+    bool halted[2];
+    u32 intr_wait[2]; // IRQs IntrWait still waits for, 0 if none
+
+    // Bus cycles since boot, the time base of the timers
+    u64 timestamp;
+    nds_timers timers[2];
+
+    // Direct Memory Access
+    nds_dma dma[2][4];
+
+    // ARM9 cycles since boot. Kept apart from the ARM7 side, the
+    // ARM9 may run on another thread.
+    u64 timestamp9;
+
+    // ARM9 division and square root unit
+    nds_math math;
+
     // IPC SYNC registers
     nds_ipc_sync sync[2];
 
@@ -134,10 +174,43 @@ typedef struct {
     // Serial Peripheral Interface (SPI)
     nds_spi_bus spi_bus;
 
+    // Cartridge save memory, NULL if there is no save file
+    u16 auxspicnt;
+    u8 auxspidata;
+    nds_backup* backup;
+
+    // Slot-1 ROM transfers
+    nds_cart_bus cart_bus;
+
     u8 mram[0x400000]; // 4MB Main Memory
     u8 swram[0x8000]; // 32KB Shared WRAM
     u8 wram7[0x10000]; // 64KB ARM7 WRAM
 
+    // ARM9 tightly coupled memory. There is no CP15 yet,
+    // so DTCM stays where the BIOS leaves it.
+    u8 itcm[0x8000]; // 32KB, mirrored below 0x02000000
+    u8 dtcm[0x4000]; // 16KB
+    u32 dtcm_base;
+
+    // Set once the system has booted
+    u8 postflg[2];
+
+    // One bit per chunk of RAM which holds decoded instructions.
+    // The handler is called when such a chunk gets written to.
+    u8 code_map[CODE_MAP_SIZE];
+    struct {
+        void* object;
+        nds_code_func method;
+    } code_handler;
+
+    // While the ARM9 runs on its own thread it must not call the code
+    // handler. Its writes are collected here and nds_code_sync reports
+    // them once both CPUs wait for each other.
+    bool code_deferred;
+    u8 code_pending[CODE_MAP_SIZE];
+    int code_pending_start;
+    int code_pending_end;
+
     // Video RAM
     u8 vram_a[0x20000]; // 128KB
     u8 vram_b[0x20000]; // 128KB
@@ -150,7 +223,8 @@ typedef struct {
     u8 vram_i[0x4000]; // 16KB
 } nds_mmu;
 
-nds_mmu* nds_make_mmu();
+nds_mmu* nds_make_mmu(char* firmware_path, const u8* firmware_image);
+void nds_free_mmu(nds_mmu* mmu);
 
 int nds7_cycles(nds_mmu* mmu, u32 address, arm_size size, bool write, arm_cycle type);
 u8 nds7_read_byte(nds_mmu* mmu, u32 address);
@@ -159,5 +233,20 @@ u32 nds7_read_word(nds_mmu* mmu, u32 address);
 void nds7_write_byte(nds_mmu* mmu, u32 address, u8 value);
 void nds7_write_hword(nds_mmu* mmu, u32 address, u16 value);
 void nds7_write_word(nds_mmu* mmu, u32 address, u32 value);
+u8* nds7_map(nds_mmu* mmu, u32 address, u32 size, bool write);
+void nds7_watch(nds_mmu* mmu, u8* code, u32 size);
+void nds_code_sync(nds_mmu* mmu);
+int nds9_cycles(nds_mmu* mmu, u32 address, arm_size size, bool write, arm_cycle type);
+u8* nds9_map(nds_mmu* mmu, u32 address, u32 size, bool write);
+u8 nds9_read_byte(nds_mmu* mmu, u32 address);
+u16 nds9_read_hword(nds_mmu* mmu, u32 address);
+u32 nds9_read_word(nds_mmu* mmu, u32 address);
+void nds9_write_byte(nds_mmu* mmu, u32 address, u8 value);
+void nds9_write_hword(nds_mmu* mmu, u32 address, u16 value);
+void nds9_write_word(nds_mmu* mmu, u32 address, u32 value);
+u8* nds7_map_vram(nds_mmu* mmu, u32 address, u32 size);
+void nds7_timer_update(nds_mmu* mmu);
+void nds7_dma_enable(nds_mmu* mmu, int index);
+void nds7_dma_trigger(nds_mmu* mmu, nds_dma_timing timing);
 
 #endif
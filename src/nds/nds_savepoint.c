@@ -0,0 +1,187 @@
+/*
+ * Copyright (C) 2016 Frederic Meyer
+ *
+ * This file is part of NoDS.
+ *
+ * NoDS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * NoDS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NoDS. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE // memfd_create, mremap
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "common/log.h"
+#include "nds_savepoint.h"
+
+// Writes the MMU to the memfd, all-zero pages stay holes
+static bool nds_savepoint_write(int fd, nds_mmu* mmu)
+{
+    static const u8 zero[4096];
+    const u8* data = (const u8*)mmu;
+
+    if (ftruncate(fd, sizeof(nds_mmu)) != 0) {
+        return false;
+    }
+
+    for (size_t offset = 0; offset < sizeof(nds_mmu); offset += sizeof(zero)) {
+        size_t size = sizeof(nds_mmu) - offset < sizeof(zero) ? sizeof(nds_mmu) - offset : sizeof(zero);
+
+        if (memcmp(&data[offset], zero, size) != 0 && pwrite(fd, &data[offset], size, offset) != size) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Must be called between frames
+nds_savepoint* nds_savepoint_make(nds_system* system)
+{
+    nds_savepoint* savepoint;
+    nds_firmware* firmware = &system->mmu->spi_bus.firmware;
+    char* cpus = NULL;
+    size_t cpus_size = 0;
+    int fd;
+    void* mapping;
+    FILE* file;
+    bool saved;
+
+    // The stream grows its buffer and does not terminate it inside
+    file = open_memstream(&cpus, &cpus_size);
+    if (file == NULL) {
+        LOG(LOG_HOST, LOG_ERROR, "SAVEPOINT: cannot save the CPUs");
+        return NULL;
+    }
+    saved = arm_save_state(system->arm7, file) && arm_save_state(system->arm9, file);
+    if (fclose(file) != 0 || !saved || cpus_size != 2 * ARM_SAVED_STATE_SIZE) {
+        LOG(LOG_HOST, LOG_ERROR, "SAVEPOINT: cannot save the CPUs");
+        free(cpus);
+        return NULL;
+    }
+
+    fd = memfd_create("nds_savepoint", MFD_CLOEXEC);
+    if (fd == -1 || !nds_savepoint_write(fd, system->mmu) ||
+        (mapping = mmap(NULL, sizeof(nds_mmu), PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+        LOG(LOG_HOST, LOG_ERROR, "SAVEPOINT: cannot create the memfd");
+        if (fd != -1) {
+            close(fd);
+        }
+        free(cpus);
+        return NULL;
+    }
+
+    // The system continues on the same pages as its children. The
+    // mapping is moved over the old one, so system->mmu stays valid.
+    if (mremap(mapping, sizeof(nds_mmu), sizeof(nds_mmu), MREMAP_MAYMOVE | MREMAP_FIXED, system->mmu) == MAP_FAILED) {
+        LOG(LOG_HOST, LOG_WARN, "SAVEPOINT: cannot remap the MMU, it is not shared with the children");
+        munmap(mapping, sizeof(nds_mmu));
+    }
+
+    savepoint = malloc(sizeof(nds_savepoint));
+    savepoint->fd = fd;
+    savepoint->header = *system->cart->header;
+    savepoint->frame = system->frame;
+    savepoint->cached = system->arm7->cache != NULL;
+    savepoint->cpus = cpus;
+
+    // A shared image stays shared, otherwise the system may change it
+    savepoint->firmware_owned = !firmware->shared;
+    if (firmware->shared) {
+        savepoint->firmware = firmware->image;
+    } else {
+        savepoint->firmware = malloc(FIRMWARE_SIZE);
+        memcpy(savepoint->firmware, firmware->image, FIRMWARE_SIZE);
+    }
+
+    savepoint->backup = system->mmu->backup != NULL ? nds_backup_copy(system->mmu->backup) : NULL;
+
+    LOG(LOG_HOST, LOG_INFO, "SAVEPOINT: made at frame %u", savepoint->frame);
+    return savepoint;
+}
+
+nds_system* nds_savepoint_fork(nds_savepoint* savepoint, nds_cartridge* cart)
+{
+    nds_system* system;
+    nds_mmu* mmu;
+    nds_firmware* firmware;
+    FILE* file;
+    bool loaded;
+
+    if (memcmp(cart->header, &savepoint->header, sizeof(nds_header)) != 0) {
+        LOG(LOG_HOST, LOG_ERROR, "SAVEPOINT: the cartridge holds another ROM");
+        return NULL;
+    }
+
+    mmu = mmap(NULL, sizeof(nds_mmu), PROT_READ | PROT_WRITE, MAP_PRIVATE, savepoint->fd, 0);
+    if (mmu == MAP_FAILED) {
+        LOG(LOG_HOST, LOG_ERROR, "SAVEPOINT: cannot map the MMU");
+        return NULL;
+    }
+
+    // Host resources belong to the child, the code map to its cache
+    mmu->code_handler.object = NULL;
+    mmu->code_handler.method = NULL;
+    mmu->code_deferred = false;
+    memset(mmu->code_map, 0, sizeof(mmu->code_map));
+    mmu->cart_bus.cart = cart;
+    mmu->backup = savepoint->backup != NULL ? nds_backup_copy(savepoint->backup) : NULL;
+
+    firmware = &mmu->spi_bus.firmware;
+    firmware->image = savepoint->firmware;
+    firmware->shared = true;
+    firmware->path = NULL;
+    firmware->dirty_start = FIRMWARE_SIZE;
+    firmware->dirty_end = 0;
+
+    system = malloc(sizeof(nds_system));
+    system->arm7 = arm_make(VER_4);
+    system->arm9 = arm_make(VER_5);
+    system->mmu = mmu;
+    system->cart = cart;
+    system->frame = savepoint->frame;
+    system->arm9_thread.running = false;
+    nds_init_cpu(system);
+
+    // Before the state is loaded, the pipeline is filled for the mode
+    nds_use_cache(system, savepoint->cached);
+
+    file = fmemopen(savepoint->cpus, 2 * ARM_SAVED_STATE_SIZE, "rb");
+    loaded = file != NULL && arm_load_state(system->arm7, file) && arm_load_state(system->arm9, file);
+    if (file != NULL) {
+        fclose(file);
+    }
+    if (!loaded) {
+        LOG(LOG_HOST, LOG_ERROR, "SAVEPOINT: cannot load the CPUs");
+        nds_free(system);
+        return NULL;
+    }
+
+    return system;
+}
+
+// Children which are still running keep their mappings
+void nds_savepoint_free(nds_savepoint* savepoint)
+{
+    close(savepoint->fd);
+    free(savepoint->cpus);
+    if (savepoint->firmware_owned) {
+        free(savepoint->firmware);
+    }
+    if (savepoint->backup != NULL) {
+        nds_backup_close(savepoint->backup);
+    }
+    free(savepoint);
+}
@@ -0,0 +1,49 @@
+/*
+ * Copyright (C) 2016 Frederic Meyer
+ *
+ * This file is part of NoDS.
+ *
+ * NoDS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * NoDS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NoDS. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _NDS_SAVEPOINT_H_
+#define _NDS_SAVEPOINT_H_
+
+#include "nds_system.h"
+#include "nds_backup.h"
+
+// A booted machine frozen in memory, to run many copies of it. The MMU
+// lives in a memfd which every child and the system the savepoint was
+// made from map privately, so they all share its pages until they write.
+//
+// Children reuse the firmware image of the savepoint, so it must be
+// freed after them. Each child needs a cartridge of its own with the
+// same ROM, see nds_make.
+typedef struct {
+    int fd;
+    nds_header header;
+    char* cpus; // both CPU states, see arm_save_state
+    u32 frame;
+    bool cached;
+
+    u8* firmware; // also used by the children until they change it
+    bool firmware_owned;
+    nds_backup* backup; // copied for each child, NULL without one
+} nds_savepoint;
+
+nds_savepoint* nds_savepoint_make(nds_system* system);
+nds_system* nds_savepoint_fork(nds_savepoint* savepoint, nds_cartridge* cart);
+void nds_savepoint_free(nds_savepoint* savepoint);
+
+#endif
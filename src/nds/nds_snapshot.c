@@ -0,0 +1,126 @@
+/*
+ * Copyright (C) 2016 Frederic Meyer
+ *
+ * This file is part of NoDS.
+ *
+ * NoDS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * NoDS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NoDS. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "common/log.h"
+#include "common/hash.h"
+#include "nds_snapshot.h"
+
+// Also covers the layout of the saved structures. The binaries are
+// hashed too, RAM holds them and a rebuilt ROM may keep its header.
+static u64 nds_snapshot_key(nds_system* system)
+{
+    const nds_header* header = system->cart->header;
+    u32 layout[] = { sizeof(nds_mmu), ARM_SAVED_STATE_SIZE };
+    u64 hash = hash_fnv1a(HASH_FNV_BASIS, header, sizeof(nds_header));
+
+    hash = hash_fnv1a(hash, layout, sizeof(layout));
+    hash = nds_cart_hash(system->cart, header->arm9.rom, header->arm9.size, hash);
+    hash = nds_cart_hash(system->cart, header->arm7.rom, header->arm7.size, hash);
+    return nds_firm_hash(&system->mmu->spi_bus.firmware, hash);
+}
+
+bool nds_save_snapshot(nds_system* system, char* path)
+{
+    FILE* file = fopen(path, "wb");
+    nds_snapshot_file header = {
+        .magic = "NDSS",
+        .version = NDS_SNAPSHOT_VERSION,
+        .key = nds_snapshot_key(system),
+        .frame = system->frame
+    };
+    bool success;
+
+    if (file == NULL) {
+        LOG(LOG_HOST, LOG_ERROR, "SNAPSHOT: cannot write %s", path);
+        return false;
+    }
+
+    success = fwrite(&header, sizeof(header), 1, file) == 1 &&
+              arm_save_state(system->arm7, file) &&
+              arm_save_state(system->arm9, file) &&
+              fwrite(system->mmu, sizeof(nds_mmu), 1, file) == 1;
+    fclose(file);
+
+    if (!success) {
+        LOG(LOG_HOST, LOG_ERROR, "SNAPSHOT: cannot write %s", path);
+        remove(path);
+        return false;
+    }
+
+    LOG(LOG_HOST, LOG_INFO, "SNAPSHOT: saved frame %u to %s", header.frame, path);
+    return true;
+}
+
+bool nds_load_snapshot(nds_system* system, char* path)
+{
+    FILE* file = fopen(path, "rb");
+    nds_snapshot_file header;
+    nds_mmu* mmu = system->mmu;
+    nds_mmu* saved;
+    arm_saved_state arm7;
+    arm_saved_state arm9;
+
+    if (file == NULL) {
+        return false;
+    }
+
+    if (fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, "NDSS", 4) != 0 ||
+        header.version != NDS_SNAPSHOT_VERSION || header.key != nds_snapshot_key(system)) {
+        LOG(LOG_HOST, LOG_WARN, "SNAPSHOT: %s is outdated, ignoring it", path);
+        fclose(file);
+        return false;
+    }
+
+    // Read and check everything before touching the running machine
+    saved = malloc(sizeof(nds_mmu));
+    if (saved == NULL || !arm_read_state(&arm7, file) || !arm_read_state(&arm9, file) ||
+        fread(saved, sizeof(nds_mmu), 1, file) != 1) {
+        LOG(LOG_HOST, LOG_ERROR, "SNAPSHOT: %s is truncated or corrupt", path);
+        free(saved);
+        fclose(file);
+        return false;
+    }
+    fclose(file);
+
+    // Host resources and the code map stay with this process
+    saved->code_handler = mmu->code_handler;
+    saved->code_deferred = mmu->code_deferred;
+    saved->spi_bus.firmware.image = mmu->spi_bus.firmware.image;
+    saved->spi_bus.firmware.shared = mmu->spi_bus.firmware.shared;
+    saved->spi_bus.firmware.path = mmu->spi_bus.firmware.path;
+    saved->spi_bus.firmware.dirty_start = mmu->spi_bus.firmware.dirty_start;
+    saved->spi_bus.firmware.dirty_end = mmu->spi_bus.firmware.dirty_end;
+    saved->backup = mmu->backup;
+    saved->cart_bus.cart = mmu->cart_bus.cart;
+    memset(saved->code_map, 0, sizeof(saved->code_map));
+    memcpy(mmu, saved, sizeof(nds_mmu));
+    free(saved);
+
+    // The CPUs prefetch from the restored memory
+    arm_restore_state(system->arm7, &arm7);
+    arm_restore_state(system->arm9, &arm9);
+
+    system->frame = header.frame;
+
+    LOG(LOG_HOST, LOG_INFO, "SNAPSHOT: resumed at frame %u from %s", header.frame, path);
+    return true;
+}
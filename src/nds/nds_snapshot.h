@@ -0,0 +1,40 @@
+/*
+ * Copyright (C) 2016 Frederic Meyer
+ *
+ * This file is part of NoDS.
+ *
+ * NoDS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * NoDS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NoDS. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _NDS_SNAPSHOT_H_
+#define _NDS_SNAPSHOT_H_
+
+#include "nds_system.h"
+
+// Saved machine state, used to skip the boot sequence on later runs.
+// Snapshots are only valid for the same ROM, firmware and build.
+
+#define NDS_SNAPSHOT_VERSION 2
+
+typedef struct {
+    char magic[4];
+    u32 version;
+    u64 key;
+    u32 frame; // frames emulated before the state was saved
+} nds_snapshot_file;
+
+bool nds_save_snapshot(nds_system* system, char* path);
+bool nds_load_snapshot(nds_system* system, char* path);
+
+#endif
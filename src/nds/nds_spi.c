@@ -20,9 +20,9 @@
 #include "nds_spi.h"
 #include "common/log.h"
 
-void nds_spi_init(nds_spi_bus* spi_bus)
+void nds_spi_init(nds_spi_bus* spi_bus, char* firmware_path, const u8* firmware_image)
 {
-    spi_bus->firmware.file_handle = fopen("firmware.bin", "rb");
+    nds_firm_open(&spi_bus->firmware, firmware_path, firmware_image);
     nds_firm_next_cmd(&spi_bus->firmware);
 }
 
@@ -42,24 +42,24 @@ void nds_spi_update_cs(nds_spi_bus* spi_bus)
 u8 nds_spi_read(nds_spi_bus* spi_bus)
 {
     if (!spi_bus->enable) {
-        LOG(LOG_ERROR, "SPI: read even though not enabled");
+        LOG(LOG_SPI, LOG_ERROR, "SPI: read even though not enabled");
         return 0;
     }
 
-    ASSERT(spi_bus->bugged, LOG_ERROR, "SPI: in bugged 16-bit mode!");
+    ASSERT(spi_bus->bugged, LOG_SPI, LOG_ERROR, "SPI: in bugged 16-bit mode!");
 
     switch (spi_bus->device) {
     case SPI_POWERMAN:
-        LOG(LOG_INFO, "SPI: POWER: unsupported read");
+        LOG(LOG_SPI, LOG_INFO, "SPI: POWER: unsupported read");
         break;
     case SPI_FIRMWARE:
-        LOG(LOG_INFO, "SPI: FIRM: read (%x)", spi_bus->firmware.data);
+        LOG(LOG_FIRM, LOG_INFO, "SPI: FIRM: read (%x)", spi_bus->firmware.data);
         return spi_bus->firmware.data;
     case SPI_TOUCHSCR:
-        LOG(LOG_INFO, "SPI: TOUCH: unsupported read");
+        LOG(LOG_SPI, LOG_INFO, "SPI: TOUCH: unsupported read");
         break;
     case SPI_RESERVED:
-        LOG(LOG_INFO, "SPI: read from RESERVED (odd code?)");
+        LOG(LOG_SPI, LOG_INFO, "SPI: read from RESERVED (odd code?)");
     }
     return 0;
 }
@@ -67,25 +67,25 @@ u8 nds_spi_read(nds_spi_bus* spi_bus)
 void nds_spi_write(nds_spi_bus* spi_bus, u8 value)
 {
     if (!spi_bus->enable) {
-        LOG(LOG_ERROR, "SPI: write even though not enabled");
+        LOG(LOG_SPI, LOG_ERROR, "SPI: write even though not enabled");
         return;
     }
 
     switch (spi_bus->device) {
     case SPI_POWERMAN:
-        LOG(LOG_INFO, "SPI: POWER: write (%x)", value);
+        LOG(LOG_SPI, LOG_INFO, "SPI: POWER: write (%x)", value);
         break;
     case SPI_FIRMWARE:
-        LOG(LOG_INFO, "SPI: FIRM: write (%x)", value);
+        LOG(LOG_FIRM, LOG_INFO, "SPI: FIRM: write (%x)", value);
         nds_firm_write(&spi_bus->firmware, value);
         if (!spi_bus->cs_hold) {
             nds_firm_next_cmd(&spi_bus->firmware);
         }
         break;
     case SPI_TOUCHSCR:
-        LOG(LOG_INFO, "SPI: TOUCH: write (%x)", value);
+        LOG(LOG_SPI, LOG_INFO, "SPI: TOUCH: write (%x)", value);
         break;
     case SPI_RESERVED:
-        LOG(LOG_INFO, "SPI: write to RESERVED (odd code?) (%x)", value);
+        LOG(LOG_SPI, LOG_INFO, "SPI: write to RESERVED (odd code?) (%x)", value);
     }
 }
@@ -52,7 +52,7 @@ typedef struct {
     nds_firmware firmware;
 } nds_spi_bus;
 
-void nds_spi_init(nds_spi_bus* spi_bus);
+void nds_spi_init(nds_spi_bus* spi_bus, char* firmware_path, const u8* firmware_image);
 void nds_spi_update_cs(nds_spi_bus* spi_bus);
 u8 nds_spi_read(nds_spi_bus* spi_bus);
 void nds_spi_write(nds_spi_bus* spi_bus, u8 value);
@@ -19,6 +19,9 @@
 
 #include <stdio.h>
 #include "common/log.h"
+#include "common/hash.h"
+#include "common/crc16.h"
+#include "arm/arm_cache.h"
 #include "nds_system.h"
 
 #define HEADER_RAM_LOC 0x3FFE00
@@ -26,7 +29,15 @@
 // this number is chosen arbitrarly currently
 #define TICKS_PER_FRAME 0x4000
 
-system_descriptor nds_descriptor = {
+// The CPUs take turns of this many ARM7 steps, the ARM9 does two
+// steps for each. Running on two threads, they see the IO writes of
+// each other no later than that.
+#define SYNC_TICKS 0x400
+
+// Where the IRQ handler reports IRQs to IntrWait (NDS7)
+#define NDS7_INTR_FLAGS 0x0380FFF8
+
+const system_descriptor nds_descriptor = {
     .name = "nds",
     .screen_width = 256,
     .screen_height = 384,
@@ -35,7 +46,7 @@ system_descriptor nds_descriptor = {
     .frame = NULL
 };
 
-arm_memory mmu7_template = {
+static const arm_memory mmu7_template = {
     .cycles = (cycle_func)nds7_cycles,
     .read_byte = (read_func)nds7_read_byte,
     .read_hword = (read_func)nds7_read_hword,
@@ -43,86 +54,322 @@ arm_memory mmu7_template = {
     .write_byte = (write_func)nds7_write_byte,
     .write_hword = (write_func)nds7_write_hword,
     .write_word = (write_func)nds7_write_word,
+    .map = (map_func)nds7_map,
+    .watch = (watch_func)nds7_watch,
+    .object = NULL
+};
+
+// The ARM9 does not use the cached interpreter, so nothing is watched
+static const arm_memory mmu9_template = {
+    .cycles = (cycle_func)nds9_cycles,
+    .read_byte = (read_func)nds9_read_byte,
+    .read_hword = (read_func)nds9_read_hword,
+    .read_word = (read_func)nds9_read_word,
+    .write_byte = (write_func)nds9_write_byte,
+    .write_hword = (write_func)nds9_write_hword,
+    .write_word = (write_func)nds9_write_word,
+    .map = (map_func)nds9_map,
+    .watch = NULL,
     .object = NULL
 };
 
+// BIOS GetCRC16: r0=initial value, r1=address, r2=length in bytes
+static void nds_swi_crc16(arm_cpu* cpu)
+{
+    arm_memory* memory = &cpu->memory;
+    u32* r = cpu->state->r;
+    u32 address = r[1] & ~1;
+    u32 size = r[2] & ~1;
+    u8* data = memory->map(memory->object, address, size, false);
+    u16 crc = r[0];
+
+    if (data != NULL) {
+        crc = crc16(crc, data, size);
+    } else {
+        for (u32 i = 0; i < size; i++) {
+            u8 value = memory->read_byte(memory->object, address + i);
+            crc = crc16(crc, &value, 1);
+        }
+    }
+
+    r[0] = crc;
+}
+
+// The comment field holds the call number, r15 is two instructions ahead
+static int nds_swi_number(arm_cpu* cpu)
+{
+    arm_state* state = cpu->state;
+    u32 address = state->r15 - ((state->cpsr & CPSR_THUMB) ? 4 : 6);
+
+    return cpu->memory.read_byte(cpu->memory.object, address) & 0xFF;
+}
+
+// BIOS IntrWait: r0=discard old flags, r1=IRQs to wait for. The game's
+// IRQ handler sets the bits it served at NDS7_INTR_FLAGS. The SWI runs
+// again after every IRQ until one of the bits is set.
+static void nds7_swi_intr_wait(arm_cpu* cpu, nds_mmu* mmu, bool discard, u32 wait)
+{
+    arm_state* state = cpu->state;
+    u32 flags = nds7_read_word(mmu, NDS7_INTR_FLAGS);
+
+    // Only the first call discards, not the repeats
+    if (discard && mmu->intr_wait[ARM7] == 0) {
+        flags &= ~wait;
+    }
+    mmu->interrupt_master[ARM7] = 1;
+
+    if (flags & wait) {
+        nds7_write_word(mmu, NDS7_INTR_FLAGS, flags & ~wait);
+        mmu->intr_wait[ARM7] = 0;
+        return;
+    }
+
+    nds7_write_word(mmu, NDS7_INTR_FLAGS, flags);
+    mmu->intr_wait[ARM7] = wait;
+    mmu->halted[ARM7] = true;
+
+    // Return to the SWI instead of the instruction after it
+    state->r15 -= (state->cpsr & CPSR_THUMB) ? 2 * SIZE_HWORD : 2 * SIZE_WORD;
+    cpu->pipeline.flush = true;
+}
+
 void nds7_swi(arm_cpu* cpu, nds_system* system)
 {
-    LOG(LOG_INFO, "SWI! r15=%x (ARM7)", system->arm7->state->r15);
+    arm_state* state = cpu->state;
+    int number = nds_swi_number(cpu);
+
+    switch (number) {
+    case 0x04:
+        nds7_swi_intr_wait(cpu, system->mmu, state->r[0] & 1, state->r[1]);
+        break;
+    case 0x05:
+        nds7_swi_intr_wait(cpu, system->mmu, true, INT_VBLANK);
+        break;
+    case 0x06:
+        system->mmu->halted[ARM7] = true;
+        break;
+    case 0x0E:
+        nds_swi_crc16(cpu);
+        break;
+    default:
+        LOG(LOG_CPU, LOG_INFO, "SWI 0x%x! r15=%x (ARM7)", number, state->r15);
+        break;
+    }
 }
 
-void nds_frame(nds_system* system)
+// The ARM9 bus has no interrupt registers yet, so nothing can wait
+void nds9_swi(arm_cpu* cpu, nds_system* system)
+{
+    int number = nds_swi_number(cpu);
+
+    switch (number) {
+    case 0x0E:
+        nds_swi_crc16(cpu);
+        break;
+    default:
+        LOG(LOG_CPU, LOG_INFO, "SWI 0x%x! r15=%x (ARM9)", number, cpu->state->r15);
+        break;
+    }
+}
+
+static void nds7_run(nds_system* system, int ticks)
 {
     nds_mmu* mmu = system->mmu;
 
-    for (int i = 0; i < TICKS_PER_FRAME; i++) {
-        u32 masked7 = mmu->interrupt_enable[ARM7] && mmu->interrupt_flag[ARM7];
-        u32 masked9 = mmu->interrupt_enable[ARM9] && mmu->interrupt_flag[ARM9];
+    for (int i = 0; i < ticks; i++) {
+        u32 masked7 = mmu->interrupt_enable[ARM7] & mmu->interrupt_flag[ARM7];
+        int cycles;
+
+        // A halted CPU skips to the next event that may raise an IRQ,
+        // the timers are the only ones that are not raised by the CPU.
+        if (mmu->halted[ARM7]) {
+            if (masked7 == 0) {
+                if (mmu->timers[ARM7].next_event == TIMER_NEVER) {
+                    break;
+                }
+                mmu->timestamp = mmu->timers[ARM7].next_event;
+                nds7_timer_update(mmu);
+                continue;
+            }
+            mmu->halted[ARM7] = false;
+        }
+
         if (mmu->interrupt_master[ARM7] && masked7) {
-            LOG(LOG_INFO, "NDS7: IRQ: Triggered with ie&if=0x%x", masked7);
+            LOG(LOG_CPU, LOG_INFO, "NDS7: IRQ: Triggered with ie&if=0x%x", masked7);
             arm_trigger_irq(system->arm7);
         }
+        cycles = system->arm7->cycles;
+
         arm_step(system->arm7);
+
+        // One compare per step, the timers do not tick
+        mmu->timestamp += (u32)(system->arm7->cycles - cycles);
+        if (mmu->timestamp >= mmu->timers[ARM7].next_event) {
+            nds7_timer_update(mmu);
+        }
     }
 }
 
-void nds_init_cpu(nds_system* system)
+static void nds9_run(nds_system* system, int ticks)
 {
-    arm_cpu* arm7 = system->arm7;
+    nds_mmu* mmu = system->mmu;
+
+    for (int i = 0; i < ticks; i++) {
+        u32 masked9 = mmu->interrupt_enable[ARM9] & mmu->interrupt_flag[ARM9];
+        int cycles;
+
+        if (mmu->interrupt_master[ARM9] && masked9) {
+            LOG(LOG_CPU, LOG_INFO, "NDS9: IRQ: Triggered with ie&if=0x%x", masked9);
+            arm_trigger_irq(system->arm9);
+        }
+        cycles = system->arm9->cycles;
+
+        arm_step(system->arm9);
+        mmu->timestamp9 += (u32)(system->arm9->cycles - cycles);
+    }
+}
+
+// Steps the ARM9 whenever nds_frame starts a turn
+static void* nds9_thread(void* object)
+{
+    nds_system* system = object;
+
+    while (true) {
+        pthread_barrier_wait(&system->arm9_thread.start);
+        if (system->arm9_thread.quit) {
+            return NULL;
+        }
+        nds9_run(system, 2 * SYNC_TICKS);
+        pthread_barrier_wait(&system->arm9_thread.done);
+    }
+}
+
+void nds_frame(nds_system* system)
+{
+    for (int i = 0; i < TICKS_PER_FRAME; i += SYNC_TICKS) {
+        if (system->arm9_thread.running) {
+            pthread_barrier_wait(&system->arm9_thread.start);
+            nds7_run(system, SYNC_TICKS);
+            pthread_barrier_wait(&system->arm9_thread.done);
+
+            // Both wait, the ARM7 may see what the ARM9 wrote to its code
+            nds_code_sync(system->mmu);
+        } else {
+            nds7_run(system, SYNC_TICKS);
+            nds9_run(system, 2 * SYNC_TICKS);
+        }
+    }
 
-    // Set NDS7 entrypoint
-    arm7->state->r15 = system->cart->header.arm7.entry;
+    system->frame++;
+}
+
+// Registers as the BIOS leaves them after booting a cartridge
+static void nds_boot_cpu(arm_cpu* cpu, u32 entry, u32 stack)
+{
+    cpu->state->cpsr = MODE_SYS;
+    cpu->state->r15 = entry;
+    cpu->state->r[12] = entry;
+    cpu->state->r[14] = entry;
 
     // Setup stack pointers for USR/SYS, IRQ and SVC
-    arm7->state->r[13] = 0x0380FEC0;
-    arm7->state->r_irq[0] = 0x0380FFA0;
-    arm7->state->r_svc[0] = 0x0380FFC0;
+    cpu->state->r[13] = stack;
+    cpu->state->r_irq[0] = stack + 0xE0;
+    cpu->state->r_svc[0] = stack + 0x100;
+}
+
+void nds_init_cpu(nds_system* system)
+{
+    arm_cpu* arm7 = system->arm7;
+    arm_cpu* arm9 = system->arm9;
 
-    // Setup SVC handler
+    nds_boot_cpu(arm7, system->cart->header->arm7.entry, 0x0380FEC0);
+    nds_boot_cpu(arm9, system->cart->header->arm9.entry, system->mmu->dtcm_base + 0x3EC0);
+
+    // Setup SVC handlers
     arm7->svc_handler.object = system;
     arm7->svc_handler.method = (arm_svc_call)nds7_swi;
+    arm9->svc_handler.object = system;
+    arm9->svc_handler.method = (arm_svc_call)nds9_swi;
 
-    // Copy MMU template and set underlying object
+    // Copy MMU templates and set underlying object
     arm7->memory = mmu7_template;
     arm7->memory.object = system->mmu;
+    arm9->memory = mmu9_template;
+    arm9->memory.object = system->mmu;
 }
 
-void nds_load_rom(nds_system* system)
+// Copies a boot binary with as few bulk copies as the memory layout allows
+static bool nds_load_binary(nds_system* system, const nds_main* binary, int cpu)
 {
     nds_mmu* mmu = system->mmu;
     nds_cartridge* cart = system->cart;
-    nds_main* binary[2] = {
-        &cart->header.arm7,
-        &cart->header.arm9
-    };
+    u32 done = 0;
 
-    // Load cartridge header to Main RAM
-    memcpy(&mmu->mram[HEADER_RAM_LOC], &cart->header, sizeof(nds_header));
-
-    // Copy executable binaries to RAM (TODO: SWRAM / WRAM7)
-    for (int i = 0; i < 2; i++) {
-        u32 size = binary[i]->size;
-        /*if (size <= BIN_MAX_SIZE_2)*/ {
-            int j = 0;
-            u8 data[size];
-            u32 dest = binary[i]->ram;
-
-            // Get binary from ROM
-            fseek(cart->rom_handle, binary[i]->rom, SEEK_SET);
-            fread(&data, 1, size, cart->rom_handle);
-
-            // Copy executable data to memory
-            while (j < size) {
-                if (i == 0) {
-                    nds7_write_byte(mmu, dest + j, data[j]);
-                } else {
-                    //...
-                }
-                j++;
+    if (binary->rom > cart->size || binary->size > cart->size - binary->rom) {
+        return false;
+    }
+
+    while (done < binary->size) {
+        u32 address = binary->ram + done;
+        u32 size = binary->size - done;
+        u8* memory;
+
+        // Stop at the next 16KB boundary if the whole rest does not map
+        memory = cpu == ARM7 ? nds7_map(mmu, address, size, true) : nds9_map(mmu, address, size, true);
+        if (memory == NULL) {
+            size = 0x4000 - (address & 0x3FFF) < size ? 0x4000 - (address & 0x3FFF) : size;
+            memory = cpu == ARM7 ? nds7_map(mmu, address, size, true) : nds9_map(mmu, address, size, true);
+        }
+
+        if (memory != NULL) {
+            nds_cart_read(cart, binary->rom + done, memory, size);
+        } else if (cpu == ARM7) {
+            u8 data[0x4000];
+
+            nds_cart_read(cart, binary->rom + done, data, size);
+            for (u32 i = 0; i < size; i++) {
+                nds7_write_byte(mmu, address + i, data[i]);
             }
-        } /*else {
-            LOG(LOG_ERROR, "NDS%d binary exceeds size limit. NOT loaded.", i == 0 ? 9 : 7);
-        }*/
+        } else {
+            return false;
+        }
+
+        done += size;
+    }
+
+    return true;
+}
+
+void nds_load_rom(nds_system* system)
+{
+    nds_mmu* mmu = system->mmu;
+    const nds_header* header = system->cart->header;
+
+    // Load cartridge header to Main RAM
+    memcpy(&mmu->mram[HEADER_RAM_LOC], header, sizeof(nds_header));
+
+    // What else the BIOS leaves in Main RAM, some titles check it
+    for (u32 base = 0x3FF800; base <= 0x3FFC00; base += 0x400) {
+        *(u32*)&mmu->mram[base + 0x0] = NDS_CHIP_ID;
+        *(u32*)&mmu->mram[base + 0x4] = NDS_CHIP_ID;
+        *(u16*)&mmu->mram[base + 0x8] = header->header_checksum;
+        *(u16*)&mmu->mram[base + 0xA] = header->secure_checksum;
+    }
+    *(u16*)&mmu->mram[0x3FF850] = 0x5835;
+    *(u16*)&mmu->mram[0x3FFC10] = 0x5835;
+    *(u16*)&mmu->mram[0x3FFC30] = 0xFFFF;
+    *(u16*)&mmu->mram[0x3FFC40] = 1; // booted from a cartridge
+
+    // SWRAM belongs to the ARM7 after boot
+    mmu->wramcnt = ARM7_ALLOC_1ND | ARM7_ALLOC_2ND;
+    mmu->postflg[ARM7] = 1;
+    mmu->postflg[ARM9] = 1;
+
+    if (!nds_load_binary(system, &header->arm7, ARM7)) {
+        LOG(LOG_CART, LOG_ERROR, "NDS7 binary does not fit at 0x%x. NOT loaded.", header->arm7.ram);
+    }
+    if (!nds_load_binary(system, &header->arm9, ARM9)) {
+        LOG(LOG_CART, LOG_ERROR, "NDS9 binary does not fit at 0x%x. NOT loaded.", header->arm9.ram);
     }
 }
 
@@ -132,14 +379,20 @@ void nds_init(nds_system* system)
     nds_load_rom(system);
 }
 
-nds_system* nds_make(nds_cartridge* cart)
+// Instances share no mutable state and may run on different threads. The
+// cartridge keeps read caches, so each needs one of its own, but opening
+// the same ROM again maps the same pages of the page cache.
+nds_system* nds_make(nds_cartridge* cart, const nds_config* config)
 {
     nds_system* system = malloc(sizeof(nds_system));
 
     system->arm7 = arm_make(VER_4);
     system->arm9 = arm_make(VER_5);
-    system->mmu = nds_make_mmu();
+    system->mmu = nds_make_mmu(config->firmware, config->firmware_image);
     system->cart = cart;
+    system->mmu->cart_bus.cart = cart;
+    system->frame = 0;
+    system->arm9_thread.running = false;
     nds_init(system);
 
     return system;
@@ -147,8 +400,84 @@ nds_system* nds_make(nds_cartridge* cart)
 
 void nds_free(nds_system* system)
 {
+    nds_use_threads(system, false);
     arm_free(system->arm7);
     arm_free(system->arm9);
-    free(system->mmu);
+    nds_firm_close(&system->mmu->spi_bus.firmware);
+    if (system->mmu->backup != NULL) {
+        nds_backup_close(system->mmu->backup);
+    }
+    nds_free_mmu(system->mmu);
     free(system);
 }
+
+void nds_use_cache(nds_system* system, bool enable)
+{
+    arm_use_cache(system->arm7, enable);
+
+    // Writes to decoded code invalidate the affected blocks
+    system->mmu->code_handler.object = system->arm7->cache;
+    system->mmu->code_handler.method = enable ? (nds_code_func)arm_cache_invalidate : NULL;
+}
+
+// Runs the ARM9 on a host thread of its own. Both CPUs still do the same
+// steps per turn, only the order of accesses to shared memory within a
+// turn is no longer fixed.
+void nds_use_threads(nds_system* system, bool enable)
+{
+    if (enable == system->arm9_thread.running) {
+        return;
+    }
+
+    if (enable) {
+        pthread_barrier_init(&system->arm9_thread.start, NULL, 2);
+        pthread_barrier_init(&system->arm9_thread.done, NULL, 2);
+        system->arm9_thread.quit = false;
+        system->mmu->code_deferred = true;
+
+        if (pthread_create(&system->arm9_thread.thread, NULL, nds9_thread, system) != 0) {
+            LOG(LOG_HOST, LOG_WARN, "cannot start the ARM9 thread, running both CPUs on one");
+            pthread_barrier_destroy(&system->arm9_thread.start);
+            pthread_barrier_destroy(&system->arm9_thread.done);
+            system->mmu->code_deferred = false;
+            return;
+        }
+    } else {
+        system->arm9_thread.quit = true;
+        pthread_barrier_wait(&system->arm9_thread.start);
+        pthread_join(system->arm9_thread.thread, NULL);
+        pthread_barrier_destroy(&system->arm9_thread.start);
+        pthread_barrier_destroy(&system->arm9_thread.done);
+        system->mmu->code_deferred = false;
+    }
+
+    system->arm9_thread.running = enable;
+}
+
+// Cache files are only valid for the ROM with the same header. Unlike
+// snapshots the binaries need not be hashed, each loaded block is
+// checked against the code in memory before it is used.
+static u64 nds_cache_key(nds_system* system)
+{
+    return hash_fnv1a(HASH_FNV_BASIS, system->cart->header, sizeof(nds_header));
+}
+
+// Maps the save file, it is flushed in the background and by nds_free
+void nds_open_backup(nds_system* system, char* path)
+{
+    system->mmu->backup = nds_backup_open(path, 0);
+}
+
+void nds_load_cache(nds_system* system, char* path)
+{
+    if (system->arm7->cache != NULL) {
+        arm_cache_load(system->arm7->cache, path, nds_cache_key(system));
+    }
+}
+
+void nds_save_cache(nds_system* system, char* path)
+{
+    if (system->arm7->cache != NULL) {
+        arm_cache_save(system->arm7->cache, path, nds_cache_key(system));
+    }
+}
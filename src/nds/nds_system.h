@@ -20,30 +20,47 @@
 #ifndef _NDS_SYSTEM_H_
 #define _NDS_SYSTEM_H_
 
+#include <pthread.h>
 #include "common/system_descriptor.h"
 #include "arm/arm_cpu.h"
 #include "nds_mmu.h"
 #include "nds_cartridge.h"
 
-/*typedef struct {
-    char* bios7;
-    char* bios9;
-    char* firmware;
-    bool hle;
-} nds_config;*/
+// Nothing in here is written to, so one config and the firmware image
+// it points to can be used by any number of instances at once.
+typedef struct {
+    char* firmware; // changes are written back unless firmware_image is set, may be NULL
+    const u8* firmware_image; // initial contents, NULL to read firmware
+} nds_config;
 
 typedef struct {
     arm_cpu* arm7;
     arm_cpu* arm9;
     nds_mmu* mmu;
     nds_cartridge* cart;
+    u32 frame;
+
+    // Steps the ARM9 next to the ARM7, see nds_use_threads
+    struct {
+        pthread_t thread;
+        pthread_barrier_t start;
+        pthread_barrier_t done;
+        bool running;
+        bool quit;
+    } arm9_thread;
 } nds_system;
 
-extern system_descriptor nds_descriptor;
+extern const system_descriptor nds_descriptor;
 
 void nds_init(nds_system* system);
-nds_system* nds_make(nds_cartridge* cart);
+void nds_init_cpu(nds_system* system);
+nds_system* nds_make(nds_cartridge* cart, const nds_config* config);
 void nds_free(nds_system* system);
 void nds_frame(nds_system* system);
+void nds_use_cache(nds_system* system, bool enable);
+void nds_use_threads(nds_system* system, bool enable);
+void nds_open_backup(nds_system* system, char* path);
+void nds_load_cache(nds_system* system, char* path);
+void nds_save_cache(nds_system* system, char* path);
 
 #endif
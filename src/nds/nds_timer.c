@@ -0,0 +1,156 @@
+/*
+ * Copyright (C) 2016 Frederic Meyer
+ *
+ * This file is part of NoDS.
+ *
+ * NoDS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * NoDS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NoDS. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "nds_timer.h"
+
+// Counting at 1, 1/64, 1/256 or 1/1024 of the bus clock
+static const int nds_timer_shift[4] = { 0, 6, 8, 10 };
+
+static inline bool nds_timer_free_running(nds_timer* timer)
+{
+    return (timer->control & (TIMER_START | TIMER_CASCADE)) == TIMER_START;
+}
+
+// Cycles from one overflow to the next
+static inline u64 nds_timer_period(nds_timer* timer)
+{
+    return (u64)(0x10000 - timer->reload) << nds_timer_shift[timer->control & TIMER_PRESCALER];
+}
+
+static void nds_timer_schedule(nds_timers* timers)
+{
+    timers->next_event = TIMER_NEVER;
+
+    for (int i = 0; i < 4; i++) {
+        nds_timer* timer = &timers->timer[i];
+
+        if (nds_timer_free_running(timer)) {
+            int shift = nds_timer_shift[timer->control & TIMER_PRESCALER];
+            timer->overflow = timer->start + ((u64)(0x10000 - timer->counter) << shift);
+        } else {
+            timer->overflow = TIMER_NEVER;
+        }
+        if (timer->overflow < timers->next_event) {
+            timers->next_event = timer->overflow;
+        }
+    }
+}
+
+void nds_timer_init(nds_timers* timers)
+{
+    for (int i = 0; i < 4; i++) {
+        timers->timer[i] = (nds_timer){ .overflow = TIMER_NEVER };
+    }
+    timers->next_event = TIMER_NEVER;
+}
+
+// Adds ticks to a timer, returns how often it overflowed
+static u64 nds_timer_add(nds_timer* timer, u64 ticks)
+{
+    u64 value = timer->counter + ticks;
+    u64 range = 0x10000 - timer->reload;
+
+    if (value < 0x10000) {
+        timer->counter = value;
+        return 0;
+    }
+
+    value -= 0x10000;
+    timer->counter = timer->reload + value % range;
+    return 1 + value / range;
+}
+
+// Counts the prescaled ticks since start into the counter
+static void nds_timer_sync(nds_timer* timer, u64 now)
+{
+    int shift = nds_timer_shift[timer->control & TIMER_PRESCALER];
+    u64 ticks;
+
+    if (!nds_timer_free_running(timer) || now <= timer->start) {
+        return;
+    }
+
+    ticks = (now - timer->start) >> shift;
+    nds_timer_add(timer, ticks);
+    timer->start += ticks << shift;
+}
+
+u16 nds_timer_read(nds_timers* timers, int index, u64 now)
+{
+    nds_timer* timer = &timers->timer[index];
+    nds_timer copy = *timer;
+
+    // Overflows are only handled by nds_timer_update, so reads count
+    // on a copy and leave the scheduled state alone.
+    nds_timer_sync(&copy, now);
+    return copy.counter;
+}
+
+void nds_timer_write_control(nds_timers* timers, int index, u8 value, u64 now)
+{
+    nds_timer* timer = &timers->timer[index];
+    bool started = !(timer->control & TIMER_START) && (value & TIMER_START);
+
+    // Timer 0 has nothing to cascade from
+    if (index == 0) {
+        value &= ~TIMER_CASCADE;
+    }
+
+    nds_timer_sync(timer, now);
+    timer->control = value;
+    timer->start = now;
+    if (started) {
+        timer->counter = timer->reload;
+    }
+
+    nds_timer_schedule(timers);
+}
+
+// Handles all overflows up to now and returns the IRQs to raise.
+// A cascading timer counts the overflows of the one before it.
+u32 nds_timer_update(nds_timers* timers, u64 now)
+{
+    u32 irq = 0;
+    u64 carry = 0;
+
+    for (int i = 0; i < 4; i++) {
+        nds_timer* timer = &timers->timer[i];
+        u64 overflows = 0;
+
+        if (nds_timer_free_running(timer)) {
+            if (timer->overflow <= now) {
+                // Resync from the first overflow, the rest is counted normally
+                overflows = 1 + (now - timer->overflow) / nds_timer_period(timer);
+                timer->start = timer->overflow + (overflows - 1) * nds_timer_period(timer);
+                timer->counter = timer->reload;
+                nds_timer_sync(timer, now);
+            }
+        } else if ((timer->control & (TIMER_START | TIMER_CASCADE)) == (TIMER_START | TIMER_CASCADE)) {
+            overflows = carry ? nds_timer_add(timer, carry) : 0;
+        }
+
+        if (overflows != 0 && (timer->control & TIMER_IRQ)) {
+            irq |= 1 << i;
+        }
+        carry = overflows;
+    }
+
+    nds_timer_schedule(timers);
+    return irq;
+}
@@ -0,0 +1,57 @@
+/*
+ * Copyright (C) 2016 Frederic Meyer
+ *
+ * This file is part of NoDS.
+ *
+ * NoDS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * NoDS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NoDS. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _NDS_TIMER_H_
+#define _NDS_TIMER_H_
+
+#include "common/types.h"
+
+// The timers never tick. A running timer remembers the timestamp its
+// counter was last known at, reads derive the current value from it,
+// and the next overflow of all four timers is a single timestamp that
+// the main loop compares against.
+
+#define TIMER_NEVER 0xFFFFFFFFFFFFFFFFULL
+
+typedef enum {
+    TIMER_PRESCALER = 3,
+    TIMER_CASCADE = 4,
+    TIMER_IRQ = 64,
+    TIMER_START = 128
+} nds_timer_control;
+
+typedef struct {
+    u16 reload;
+    u8 control;
+    u16 counter; // value at start
+    u64 start; // timestamp of the last prescaled tick counted
+    u64 overflow; // TIMER_NEVER if stopped or cascading
+} nds_timer;
+
+typedef struct {
+    nds_timer timer[4];
+    u64 next_event;
+} nds_timers;
+
+void nds_timer_init(nds_timers* timers);
+u16 nds_timer_read(nds_timers* timers, int index, u64 now);
+void nds_timer_write_control(nds_timers* timers, int index, u8 value, u64 now);
+u32 nds_timer_update(nds_timers* timers, u64 now);
+
+#endif
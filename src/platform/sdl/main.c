@@ -18,85 +18,300 @@
  */
 
 #include <SDL/SDL.h>
+#include <unistd.h>
 #include "common/types.h"
 #include "common/log.h"
 #include "arm/gdb/arm_gdb.h"
 #include "nds/nds_cartridge.h"
 #include "nds/nds_system.h"
+#include "nds/nds_snapshot.h"
 #include "version.h"
 
-SDL_Surface* window;
+#ifdef ARM_PROFILE
+#include <signal.h>
+#include "arm/arm_profile.h"
+#include "common/elf_symbols.h"
 
-void create_window(int width, int height)
+#define OPTIONS "b:cs:t"
+
+// Set by SIGUSR1, the report is printed from the main loop
+volatile sig_atomic_t profile_requested = false;
+elf_symbols* symbols = NULL;
+
+void request_profile(int signal)
+{
+    profile_requested = true;
+}
+
+// Prints the hot spots and writes the call stacks to rom_path.folded
+void write_profile(nds_system* system, char* rom_path)
+{
+    char* folded_path = malloc(strlen(rom_path) + sizeof(".folded"));
+    FILE* file;
+
+    arm_profile_report(system->arm7->profile, stderr);
+
+    sprintf(folded_path, "%s.folded", rom_path);
+    file = fopen(folded_path, "w");
+    if (file != NULL) {
+        arm_profile_write_folded(system->arm7->profile, file, symbols);
+        fclose(file);
+    } else {
+        LOG(LOG_HOST, LOG_ERROR, "fopen: %s", folded_path);
+    }
+    free(folded_path);
+}
+#else
+#define OPTIONS "b:ct"
+#endif
+
+#ifdef ARM_TRACE
+#include <fcntl.h>
+#include <signal.h>
+#include "arm/arm_trace.h"
+
+// Set by SIGUSR2, the trace is dumped from the main loop
+volatile sig_atomic_t trace_requested = false;
+arm_trace* trace = NULL;
+char* trace_path = NULL;
+
+void request_trace(int signal)
 {
+    trace_requested = true;
+}
+
+// Writes the last executed instructions to rom_path.trace
+void write_trace()
+{
+    int fd;
+
+    if (trace == NULL) {
+        return;
+    }
+
+    fd = open(trace_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd != -1) {
+        arm_trace_dump(trace, fd);
+        close(fd);
+    }
+}
+
+// Dumps the trace before the emulator goes down
+void crash_trace(int sig)
+{
+    write_trace();
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+#endif
+
+SDL_Surface* create_window(int width, int height)
+{
+    SDL_Surface* window;
+
     // Init SDL
     if (SDL_Init(SDL_INIT_EVERYTHING) != 0) {
-        LOG(LOG_ERROR, "SDL_Init: %s", SDL_GetError());
+        LOG(LOG_HOST, LOG_ERROR, "SDL_Init: %s", SDL_GetError());
         SDL_Quit();
     }
 
     // Create SDL window
     window = SDL_SetVideoMode(width, height, 32, SDL_HWSURFACE);
     if (window == NULL) {
-        LOG(LOG_ERROR, "SDL_SetVideoMode: %s", SDL_GetError());
+        LOG(LOG_HOST, LOG_ERROR, "SDL_SetVideoMode: %s", SDL_GetError());
         SDL_Quit();
     }
 
     // Set window title
     SDL_WM_SetCaption("NoDS " VERSION_STRING, "NoDS");
+
+    return window;
+}
+
+void usage()
+{
+#ifdef ARM_PROFILE
+    puts("usage: ./nods [-b frames] [-c] [-t] [-s symbols.elf] rom_path");
+#else
+    puts("usage: ./nods [-b frames] [-c] [-t] rom_path");
+#endif
+    puts("  -b  resume from rom_path.boot, or save it after that many frames (F12 saves it any time)");
+    puts("  -c  use the cached interpreter, decoded blocks are kept in rom_path.cache");
+    puts("  -t  run the ARM9 on a thread of its own");
+#ifdef ARM_PROFILE
+    puts("  -s  name the functions in rom_path.folded after the symbols of an ELF file");
+#endif
+#ifdef ARM_TRACE
+    puts("SIGUSR2 or a crash writes the last executed instructions to rom_path.trace");
+#endif
 }
 
 int main(int argc, char** argv)
 {
     SDL_Event event;
+    SDL_Surface* window;
     nds_cartridge* cart;
     nds_system* system;
     bool running = true;
+    bool cached = false;
+    bool threaded = false;
     system_descriptor descriptor = nds_descriptor;
+    nds_config config = {
+        .firmware = "firmware.bin",
+        .firmware_image = NULL
+    };
+    int option;
+    char* cache_path;
+    char* boot_path;
+    char* save_path;
+    char* secure_path;
+    int boot_frames = -1;
+
+    while ((option = getopt(argc, argv, OPTIONS)) != -1) {
+        switch (option) {
+        case 'b':
+            boot_frames = atoi(optarg);
+            break;
+        case 'c':
+            cached = true;
+            break;
+        case 't':
+            threaded = true;
+            break;
+#ifdef ARM_PROFILE
+        case 's':
+            symbols = elf_load_symbols(optarg);
+            break;
+#endif
+        default:
+            usage();
+            return 0;
+        }
+    }
 
-    if (argc != 2) {
-        puts("usage: ./nods rom_path");
+    if (optind != argc - 1) {
+        usage();
         return 0;
     }
 
     // Open supplied ROM.
-    cart = nds_cart_open(argv[1]);
-    system = nds_make(cart);
+    cart = nds_cart_open(argv[optind], CART_MAP_DEFAULT);
 
     // Did we read the file?
     if (cart == NULL) {
-        LOG(LOG_ERROR, "nds_cart_open: cannot open file.");
-        SDL_Quit();
+        LOG(LOG_CART, LOG_ERROR, "nds_cart_open: cannot open file.");
+        return 1;
+    }
+
+    // Encrypted dumps need the KEY1 tables of the ARM7 BIOS, but only
+    // until the decrypted secure area has been kept next to the ROM
+    secure_path = malloc(strlen(argv[optind]) + sizeof(".secure"));
+    sprintf(secure_path, "%s.secure", argv[optind]);
+    nds_cart_decrypt(cart, "bios7.bin", secure_path);
+    free(secure_path);
+
+    system = nds_make(cart, &config);
+    nds_use_cache(system, cached);
+    nds_use_threads(system, threaded);
+
+    // Game saves are kept next to the ROM
+    save_path = malloc(strlen(argv[optind]) + sizeof(".sav"));
+    sprintf(save_path, "%s.sav", argv[optind]);
+    nds_open_backup(system, save_path);
+    free(save_path);
+
+    // Reuse the blocks decoded by previous runs
+    cache_path = malloc(strlen(argv[optind]) + sizeof(".cache"));
+    sprintf(cache_path, "%s.cache", argv[optind]);
+    nds_load_cache(system, cache_path);
+
+    // Skip the boot sequence if it was saved before
+    boot_path = malloc(strlen(argv[optind]) + sizeof(".boot"));
+    sprintf(boot_path, "%s.boot", argv[optind]);
+    if (boot_frames >= 0 && nds_load_snapshot(system, boot_path)) {
+        boot_frames = -1;
     }
 
     // Debug output (header)
-    LOG(LOG_INFO, "game_code=%s", NDS_STRING(cart->header.game_title, 12));
-    LOG(LOG_INFO, "arm9_rom=%x", cart->header.arm9.rom);
-    LOG(LOG_INFO, "arm9_ram=%x", cart->header.arm9.ram);
-    LOG(LOG_INFO, "arm9_entry=%x", cart->header.arm9.entry);
-    LOG(LOG_INFO, "arm9_size=%x", cart->header.arm9.size);
-    LOG(LOG_INFO, "arm7_rom=%x", cart->header.arm7.rom);
-    LOG(LOG_INFO, "arm7_ram=%x", cart->header.arm7.ram);
-    LOG(LOG_INFO, "arm7_entry=%x", cart->header.arm7.entry);
-    LOG(LOG_INFO, "arm7_size=%x", cart->header.arm7.size);
+    LOG(LOG_CART, LOG_INFO, "game_code=%s", NDS_STRING(cart->header->game_title, 12));
+    LOG(LOG_CART, LOG_INFO, "arm9_rom=%x", cart->header->arm9.rom);
+    LOG(LOG_CART, LOG_INFO, "arm9_ram=%x", cart->header->arm9.ram);
+    LOG(LOG_CART, LOG_INFO, "arm9_entry=%x", cart->header->arm9.entry);
+    LOG(LOG_CART, LOG_INFO, "arm9_size=%x", cart->header->arm9.size);
+    LOG(LOG_CART, LOG_INFO, "arm7_rom=%x", cart->header->arm7.rom);
+    LOG(LOG_CART, LOG_INFO, "arm7_ram=%x", cart->header->arm7.ram);
+    LOG(LOG_CART, LOG_INFO, "arm7_entry=%x", cart->header->arm7.entry);
+    LOG(LOG_CART, LOG_INFO, "arm7_size=%x", cart->header->arm7.size);
 
     // Setup window
-    create_window(descriptor.screen_width, descriptor.screen_height);
+    window = create_window(descriptor.screen_width, descriptor.screen_height);
+
+#ifdef ARM_PROFILE
+    signal(SIGUSR1, request_profile);
+#endif
+
+#ifdef ARM_TRACE
+    trace = system->arm7->trace;
+    trace_path = malloc(strlen(argv[optind]) + sizeof(".trace"));
+    sprintf(trace_path, "%s.trace", argv[optind]);
+    signal(SIGUSR2, request_trace);
+    signal(SIGSEGV, crash_trace);
+    signal(SIGABRT, crash_trace);
+    signal(SIGILL, crash_trace);
+    signal(SIGFPE, crash_trace);
+#endif
 
     // SDL mainloop
     while (running) {
         //arm_step(system->arm7);
         nds_frame(system);
 
+        if (system->frame == boot_frames) {
+            nds_save_snapshot(system, boot_path);
+        }
+
+#ifdef ARM_PROFILE
+        if (profile_requested) {
+            write_profile(system, argv[optind]);
+            profile_requested = false;
+        }
+#endif
+
+#ifdef ARM_TRACE
+        if (trace_requested) {
+            write_trace();
+            trace_requested = false;
+        }
+#endif
+
         // Process SDL events
         while (SDL_PollEvent(&event)) {
             if (event.type == SDL_QUIT) {
                 running = false;
+            } else if (event.type == SDL_KEYDOWN && event.key.keysym.sym == SDLK_F12) {
+                nds_save_snapshot(system, boot_path);
             }
         }
         SDL_Flip(window);
     }
 
+    nds_save_cache(system, cache_path);
+    free(cache_path);
+    free(boot_path);
+
+#ifdef ARM_PROFILE
+    write_profile(system, argv[optind]);
+#endif
+
+#ifdef ARM_TRACE
+    // The trace goes away with the CPU
+    trace = NULL;
+#endif
+
+    // Writes back firmware changes
+    nds_free(system);
+    nds_cart_close(cart);
+
     SDL_FreeSurface(window);
     return 0;
 }
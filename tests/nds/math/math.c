@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2016 Frederic Meyer
+ *
+ * This file is part of NoDS.
+ *
+ * NoDS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * NoDS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NoDS. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Checks the division unit against results measured on hardware, see
+// GBATEK "DS Maths". Build and run with make test.
+
+#include <stdio.h>
+#include "nds/nds_math.h"
+
+static int failed = 0;
+
+static void math_write64(nds_math* math, u32 offset, u64 value)
+{
+    for (int i = 0; i < 8; i++) {
+        nds_math_write(math, offset + i, value >> (i * 8), 0);
+    }
+}
+
+static u64 math_read64(nds_math* math, u32 offset)
+{
+    u64 value = 0;
+
+    for (int i = 0; i < 8; i++) {
+        value |= (u64)nds_math_read(math, offset + i, 0) << (i * 8);
+    }
+    return value;
+}
+
+static void check_div(int mode, u64 numer, u64 denom, u64 quotient, u64 remainder, bool div0)
+{
+    nds_math math = { 0 };
+    u64 got_quotient;
+    u64 got_remainder;
+    bool got_div0;
+
+    nds_math_write(&math, MATH_DIVCNT, mode, 0);
+    math_write64(&math, MATH_DIV_NUMER, numer);
+    math_write64(&math, MATH_DIV_DENOM, denom);
+
+    got_quotient = math_read64(&math, MATH_DIV_RESULT);
+    got_remainder = math_read64(&math, MATH_DIVREM_RESULT);
+    got_div0 = nds_math_read(&math, MATH_DIVCNT + 1, MATH_DIV_CYCLES_64) & 0x40;
+
+    if (got_quotient != quotient || got_remainder != remainder || got_div0 != div0) {
+        printf("FAIL mode %d: %016llx / %016llx = %016llx r %016llx div0 %d, expected %016llx r %016llx div0 %d\n",
+               mode, (unsigned long long)numer, (unsigned long long)denom,
+               (unsigned long long)got_quotient, (unsigned long long)got_remainder, got_div0,
+               (unsigned long long)quotient, (unsigned long long)remainder, div0);
+        failed++;
+    }
+}
+
+int main(void)
+{
+    // 32/32
+    check_div(0, 7, 2, 3, 1, false);
+    check_div(0, 5, 0, 0x00000000FFFFFFFFULL, 5, true);
+    check_div(0, 0, 0, 0x00000000FFFFFFFFULL, 0, true);
+    check_div(0, 0xFFFFFFFB, 0, 0xFFFFFFFF00000001ULL, 0xFFFFFFFFFFFFFFFBULL, true);
+    check_div(0, 0x80000000, 0xFFFFFFFF, 0x80000000, 0, false);
+
+    // 64/32
+    check_div(1, 0x100000000ULL, 2, 0x80000000, 0, false);
+    check_div(1, 5, 0, 0xFFFFFFFFFFFFFFFFULL, 5, true);
+    check_div(1, 0xFFFFFFFFFFFFFFFBULL, 0, 1, 0xFFFFFFFFFFFFFFFBULL, true);
+    check_div(1, 0x8000000000000000ULL, 0xFFFFFFFF, 0x8000000000000000ULL, 0, false);
+
+    // 64/64
+    check_div(2, 0x100000000ULL, 0x10000, 0x10000, 0, false);
+    check_div(2, 5, 0, 0xFFFFFFFFFFFFFFFFULL, 5, true);
+    check_div(2, 0xFFFFFFFFFFFFFFFBULL, 0, 1, 0xFFFFFFFFFFFFFFFBULL, true);
+    check_div(2, 0x8000000000000000ULL, 0xFFFFFFFFFFFFFFFFULL, 0x8000000000000000ULL, 0, false);
+
+    // DIV0 looks at all 64 bits of the denominator, the 32-bit modes do not
+    check_div(0, 5, 0x100000000ULL, 0x00000000FFFFFFFFULL, 5, false);
+
+    printf("math: %s\n", failed ? "FAILED" : "passed");
+    return failed != 0;
+}
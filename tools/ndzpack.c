@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) 2016 Frederic Meyer
+ *
+ * This file is part of NoDS.
+ *
+ * NoDS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * NoDS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NoDS. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Converts a cartridge image into the compressed container which
+// nds_cart_open reads like the raw image:
+//     ./ndzpack rom.nds rom.ndz
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "common/lz.h"
+#include "nds/nds_chunked.h"
+
+int main(int argc, char** argv)
+{
+    FILE* in;
+    FILE* out;
+    nds_chunked_header header = { .magic = CHUNKED_MAGIC, .version = CHUNKED_VERSION, .chunk_size = CHUNKED_CHUNK_SIZE };
+    u8* chunk = malloc(CHUNKED_CHUNK_SIZE);
+    u8* packed = malloc(LZ_BOUND(CHUNKED_CHUNK_SIZE));
+    u32* index;
+    long size;
+
+    if (argc != 3) {
+        puts("usage: ./ndzpack rom_path container_path");
+        return 0;
+    }
+
+    in = fopen(argv[1], "rb");
+    if (in == NULL || fseek(in, 0, SEEK_END) != 0 || (size = ftell(in)) < 0 || size > 0xFFFFFFFF) {
+        fprintf(stderr, "cannot read %s\n", argv[1]);
+        return 1;
+    }
+    rewind(in);
+
+    out = fopen(argv[2], "wb");
+    if (out == NULL) {
+        fprintf(stderr, "cannot open %s\n", argv[2]);
+        return 1;
+    }
+
+    header.size = size;
+    header.count = ((u64)header.size + CHUNKED_CHUNK_SIZE - 1) / CHUNKED_CHUNK_SIZE;
+    index = calloc(header.count + 1, sizeof(u32));
+    index[0] = sizeof(header) + (header.count + 1) * sizeof(u32);
+
+    // The index is written again once the chunk sizes are known
+    fwrite(&header, sizeof(header), 1, out);
+    fwrite(index, sizeof(u32), header.count + 1, out);
+
+    for (u32 i = 0; i < header.count; i++) {
+        u32 length = header.size - i * CHUNKED_CHUNK_SIZE < CHUNKED_CHUNK_SIZE ?
+                     header.size - i * CHUNKED_CHUNK_SIZE : CHUNKED_CHUNK_SIZE;
+        u32 packed_size;
+
+        if (fread(chunk, 1, length, in) != length) {
+            fprintf(stderr, "cannot read %s\n", argv[1]);
+            return 1;
+        }
+
+        // Chunks which do not shrink are stored as they are
+        packed_size = lz_compress(chunk, length, packed, LZ_BOUND(CHUNKED_CHUNK_SIZE));
+        if (packed_size >= length) {
+            fwrite(chunk, 1, length, out);
+            packed_size = length;
+        } else {
+            fwrite(packed, 1, packed_size, out);
+        }
+        index[i + 1] = index[i] + packed_size;
+    }
+
+    fseek(out, sizeof(header), SEEK_SET);
+    fwrite(index, sizeof(u32), header.count + 1, out);
+
+    if (ferror(out) || fclose(out) != 0) {
+        fprintf(stderr, "cannot write %s\n", argv[2]);
+        return 1;
+    }
+    fclose(in);
+
+    printf("%s: %u -> %u bytes in %u chunks\n", argv[2], header.size, index[header.count], header.count);
+    return 0;
+}
@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2016 Frederic Meyer
+ *
+ * This file is part of NoDS.
+ *
+ * NoDS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * NoDS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NoDS. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Prints a trace dump written by a TRACE=1 build of NoDS:
+//     ./tracedump rom_path.trace [count]
+// Only the last count instructions are printed if given.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "arm/arm_cpu.h"
+#include "arm/arm_disasm.h"
+#include "arm/arm_trace.h"
+
+int main(int argc, char** argv)
+{
+    FILE* file;
+    arm_trace_header header;
+    arm_trace_entry entry;
+    u32 skip = 0;
+
+    if (argc < 2 || argc > 3) {
+        puts("usage: ./tracedump trace_path [count]");
+        return 0;
+    }
+
+    file = fopen(argv[1], "rb");
+    if (file == NULL) {
+        fprintf(stderr, "cannot open %s\n", argv[1]);
+        return 1;
+    }
+
+    if (fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, "NDST", 4) != 0 ||
+        header.version != TRACE_VERSION || header.entry_size != sizeof(arm_trace_entry)) {
+        fprintf(stderr, "%s is not a trace of this version\n", argv[1]);
+        fclose(file);
+        return 1;
+    }
+
+    if (argc == 3 && (u32)atoi(argv[2]) < header.count) {
+        skip = header.count - atoi(argv[2]);
+        fseek(file, skip * sizeof(arm_trace_entry), SEEK_CUR);
+    }
+
+    for (u32 i = skip; i < header.count && fread(&entry, sizeof(entry), 1, file) == 1; i++) {
+        bool thumb = entry.cpsr & CPSR_THUMB;
+        char text[128];
+
+        if (thumb) {
+            arm_disasm_thumb(entry.address, entry.opcode, text, sizeof(text));
+        } else {
+            arm_disasm(entry.address, entry.opcode, text, sizeof(text));
+        }
+
+        printf("%10u  %08x  %*s%0*x  %c%c%c%c %02x  %-40s", i, entry.address, thumb ? 4 : 0, "", thumb ? 4 : 8, entry.opcode,
+               entry.cpsr & CPSR_SIGN ? 'N' : '-', entry.cpsr & CPSR_ZERO ? 'Z' : '-',
+               entry.cpsr & CPSR_CARRY ? 'C' : '-', entry.cpsr & CPSR_OVERFLOW ? 'V' : '-',
+               entry.cpsr & CPSR_MODE, text);
+
+        if (entry.mem_access == TRACE_READ) {
+            printf("  [%08x] -> %x", entry.mem_address, entry.mem_value);
+        } else if (entry.mem_access == TRACE_WRITE) {
+            printf("  [%08x] <- %x", entry.mem_address, entry.mem_value);
+        }
+        putchar('\n');
+    }
+
+    fclose(file);
+    return 0;
+}